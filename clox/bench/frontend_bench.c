@@ -0,0 +1,253 @@
+// Throughput benchmarks for the front end: scan_token() on its own, and
+// compile(), which scans as it goes. Sources are generated in memory to
+// stress different parts of it. Build and run with `make bench-frontend`.
+//
+// Each measurement is the fastest of REPEAT runs.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "number.h"
+#include "scanner.h"
+#include "vm.h"
+
+#define SOURCE_SIZE (4 * 1024 * 1024)
+#define REPEAT 10
+
+/* ---- Sources ---- */
+
+typedef struct {
+  char* text;
+  size_t length;
+  size_t capacity;
+} Buffer;
+
+static void append(Buffer* buffer, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  char line[256];
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+
+  if (buffer->length + (size_t)length + 1 > buffer->capacity) {
+    buffer->capacity = buffer->capacity * 2 + sizeof(line);
+    buffer->text = realloc(buffer->text, buffer->capacity);
+  }
+  memcpy(buffer->text + buffer->length, line, (size_t)length + 1);
+  buffer->length += (size_t)length;
+}
+
+// Long arithmetic expressions, mostly punctuation and small numbers
+static void make_expressions(Buffer* buffer, unsigned i) {
+  append(buffer, "print (%u + 2.5) * (3 - %u) / -(4 + 5 * (6 - 7)) - 8;\n",
+         i % 100, i % 7);
+}
+
+// Declarations and assignments with long names and larger numbers. Names
+// repeat so the number of globals stays bounded.
+static void make_identifiers(Buffer* buffer, unsigned i) {
+  append(buffer,
+         "var accumulated_total_%u = previous_running_value_%u * %u.%u + "
+         "adjustment_factor_%u;\n",
+         i % 1000, (i + 1) % 1000, i, i % 97, i % 13);
+}
+
+// Indented code buried in comments
+static void make_comments(Buffer* buffer, unsigned i) {
+  append(buffer,
+         "        // Step %u: nothing much happens here, but the comment is "
+         "long enough\n"
+         "        // to wrap onto a second line, as comments in generated "
+         "code do.\n"
+         "        var value_%u = %u;\n",
+         i, i % 1000, i);
+}
+
+// String literals of various lengths
+static void make_strings(Buffer* buffer, unsigned i) {
+  append(buffer, "print \"short\" + \"a somewhat longer string literal %u\";\n",
+         i % 500);
+}
+
+// Number literals: small integers, prices, long fractions and large
+// integers
+static void make_numbers(Buffer* buffer, unsigned i) {
+  append(buffer, "print %u + %u.%02u * 0.%09u - %u%06u.5;\n", i % 1000,
+         i % 100000, i % 100, i * 2654435761u % 1000000000u, i, i % 999983);
+}
+
+// Keywords and keyword-like identifiers in a pseudo-random order, so the
+// branch predictor can't learn the sequence. This doesn't compile.
+static void make_keywords(Buffer* buffer, unsigned i) {
+  static const char* words[] = {
+      "class", "fun",   "var",    "for",      "if",     "else",
+      "while", "return", "this",  "super",    "and",    "or",
+      "nil",   "true",  "false",  "print",    "classy", "fund",
+      "iffy",  "format", "orb",   "elsewhere", "variable",
+  };
+  const unsigned count = sizeof(words) / sizeof(words[0]);
+  unsigned state = i * 2654435761u + 1;
+  for (int word = 0; word < 12; word++) {
+    state = state * 1103515245u + 12345u;
+    append(buffer, "%s ", words[(state >> 16) % count]);
+  }
+  append(buffer, "\n");
+}
+
+typedef struct {
+  const char* name;
+  void (*make)(Buffer* buffer, unsigned i);
+  bool compiles;
+} SourceKind;
+
+static const SourceKind kinds[] = {
+    {"expressions", make_expressions, true},
+    {"identifiers", make_identifiers, true},
+    {"comments", make_comments, true},
+    {"strings", make_strings, true},
+    {"numbers", make_numbers, true},
+    {"keywords", make_keywords, false},
+};
+
+static Buffer make_source(const SourceKind* kind) {
+  Buffer buffer = {NULL, 0, 0};
+  for (unsigned i = 0; buffer.length < SOURCE_SIZE; i++) {
+    kind->make(&buffer, i);
+  }
+  return buffer;
+}
+
+/* ---- Benchmarks ---- */
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void bench_scanner(const SourceKind* kind, Buffer* source) {
+  double best = 0;
+  size_t tokens = 0;
+  for (int run = 0; run < REPEAT; run++) {
+    Scanner scanner;
+    scanner_init(&scanner, source->text);
+    tokens = 0;
+
+    double start = now();
+    for (;;) {
+      Token token = scan_token(&scanner);
+      tokens++;
+      if (token.type == TOKEN_EOF) {
+        break;
+      }
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  printf("%-12s scan     %8.2f Mtokens/s %8.2f MB/s\n", kind->name,
+         (double)tokens / best * 1e3, (double)source->length / best * 1e3);
+}
+
+static void bench_compiler(const SourceKind* kind, Buffer* source) {
+  double best = 0;
+  size_t emitted = 0;
+  for (int run = 0; run < REPEAT; run++) {
+    VM vm;
+    vm_init(&vm, system_allocator());
+    Chunk chunk;
+    chunk_init(&chunk, system_allocator());
+
+    double start = now();
+    if (!compile(&vm, source->text, &chunk)) {
+      fprintf(stderr, "%s: compile error\n", kind->name);
+      exit(1);
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+    }
+    emitted = chunk.count;
+
+    chunk_free(&chunk);
+    vm_free(&vm);
+  }
+
+  printf("%-12s compile  %8.2f MB/s out %5.2f MB/s in\n", kind->name,
+         (double)emitted / best * 1e3, (double)source->length / best * 1e3);
+}
+
+// number_parse() against strtod() on the number literals of `source`
+static void bench_numbers(Buffer* source) {
+  Token* numbers = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  Scanner scanner;
+  scanner_init(&scanner, source->text);
+  for (Token token = scan_token(&scanner); token.type != TOKEN_EOF;
+       token = scan_token(&scanner)) {
+    if (token.type != TOKEN_NUMBER) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity = capacity * 2 + 1024;
+      numbers = realloc(numbers, capacity * sizeof(Token));
+    }
+    numbers[count++] = token;
+  }
+
+  double parse_best = 0;
+  double strtod_best = 0;
+  double sum = 0;
+  for (int run = 0; run < REPEAT; run++) {
+    double start = now();
+    for (size_t i = 0; i < count; i++) {
+      sum += number_parse(numbers[i].start, (size_t)numbers[i].length);
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < parse_best) {
+      parse_best = elapsed;
+    }
+
+    start = now();
+    for (size_t i = 0; i < count; i++) {
+      sum += strtod(numbers[i].start, NULL);
+    }
+    elapsed = now() - start;
+    if (run == 0 || elapsed < strtod_best) {
+      strtod_best = elapsed;
+    }
+  }
+
+  // Printing the sum keeps the conversions from being optimized away
+  printf("%-12s parse    %8.2f Mnumbers/s, strtod %.2f Mnumbers/s (%g)\n",
+         "numbers", (double)count / parse_best * 1e3,
+         (double)count / strtod_best * 1e3, sum);
+  free(numbers);
+}
+
+int main(void) {
+  printf("%d MB sources, best of %d\n\n", SOURCE_SIZE / (1024 * 1024),
+         REPEAT);
+
+  for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+    Buffer source = make_source(&kinds[i]);
+    bench_scanner(&kinds[i], &source);
+    if (kinds[i].compiles) {
+      bench_compiler(&kinds[i], &source);
+    }
+    if (kinds[i].make == make_numbers) {
+      bench_numbers(&source);
+    }
+    free(source.text);
+  }
+  return 0;
+}
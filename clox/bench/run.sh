@@ -0,0 +1,104 @@
+#!/bin/sh
+# Times the Lox programs in bench/lox with the given clox, and with jslox as
+# well if JSLOX is set to a command that runs it, for example
+# JSLOX="node ../jslox/build/index.js". `make bench` builds an optimized
+# clox and runs this.
+#
+# Each program is run RUNS times (10 by default). Wall times include
+# starting the process and compiling; "run" is the time clox spends in the
+# interpreter loop, from --stats. Instructions are counted once, with
+# --profile.
+#
+# Lox has no loops yet, so each program's body, from its "// repeat N"
+# line to the end of the file, is unrolled N times before it is run.
+#
+# Needs a date(1) that supports %N, such as GNU date.
+
+set -eu
+
+if [ $# -ne 1 ]; then
+  echo "Usage: $0 path/to/clox" >&2
+  exit 64
+fi
+
+clox=$1
+runs=${RUNS:-10}
+jslox=${JSLOX:-}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+now_us() {
+  echo $(($(date +%s%N) / 1000))
+}
+
+unroll() {
+  awk '
+    /^\/\/ repeat [0-9]+$/ { n = $3; body = 1; next }
+    body { lines[++count] = $0; next }
+    { print }
+    END {
+      for (i = 0; i < n; i++) {
+        for (j = 1; j <= count; j++) print lines[j]
+      }
+    }
+  ' "$1"
+}
+
+# Prints the median, 90th percentile and maximum of the numbers on stdin
+summarize() {
+  sort -n | awk '
+    { v[NR] = $1 }
+    END {
+      p90 = int((NR * 9 + 9) / 10)
+      printf "%9.2f %9.2f %9.2f", v[int((NR + 1) / 2)], v[p90], v[NR]
+    }
+  '
+}
+
+# Runs "$@" RUNS times, appending wall times in milliseconds to $tmp/wall.
+# With --stats, clox's run times go to $tmp/run.
+time_runs() {
+  : > "$tmp/wall"
+  : > "$tmp/run"
+  i=0
+  while [ "$i" -lt "$runs" ]; do
+    start=$(now_us)
+    if ! "$@" > /dev/null 2> "$tmp/stderr"; then
+      echo "error: $* failed" >&2
+      cat "$tmp/stderr" >&2
+      exit 1
+    fi
+    end=$(now_us)
+    awk -v us=$((end - start)) 'BEGIN { printf "%.2f\n", us / 1000 }' \
+      >> "$tmp/wall"
+    awk '/^run time/ { print $3 }' "$tmp/stderr" >> "$tmp/run"
+    i=$((i + 1))
+  done
+}
+
+printf '%-18s %9s %9s %9s %9s %10s\n' "wall ms" median p90 max \
+  "run ms" "Minstr/s"
+
+for source in "$dir"/lox/*.lox; do
+  name=$(basename "$source" .lox)
+  program="$tmp/$name.lox"
+  unroll "$source" > "$program"
+
+  instructions=$("$clox" --profile "$program" 2>&1 > /dev/null |
+                 awk '$1 == "total" { print $2 }')
+
+  time_runs "$clox" --stats "$program"
+  run=$(summarize < "$tmp/run" | awk '{ print $1 }')
+  mips=$(awk -v n="$instructions" -v ms="$run" \
+             'BEGIN { printf "%.1f", (ms > 0) ? n / ms / 1000 : 0 }')
+  printf '%-18s %s %9s %10s\n' "$name" "$(summarize < "$tmp/wall")" \
+    "$run" "$mips"
+
+  if [ -n "$jslox" ]; then
+    # Word splitting is wanted: JSLOX is a command line
+    # shellcheck disable=SC2086
+    time_runs $jslox "$program"
+    printf '%-18s %s\n' "$name (jslox)" "$(summarize < "$tmp/wall")"
+  fi
+done
@@ -0,0 +1,101 @@
+// Counts the sequences of two and three opcodes that the Lox program
+// benchmarks execute, which is what superinstructions are chosen from.
+// Build and run with `make bench-sequences`.
+//
+// Each program is unrolled the way run.sh does it, and all of them run with
+// the same profile attached, so the report covers the whole corpus.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "vm.h"
+
+static char* read_file(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+  char* text = malloc((size_t)size + 1);
+  if (text == NULL || fread(text, 1, (size_t)size, f) != (size_t)size) {
+    free(text);
+    fclose(f);
+    return NULL;
+  }
+  text[size] = '\0';
+  fclose(f);
+  return text;
+}
+
+// Repeats everything after the "// repeat N" line N times
+static char* unroll(const char* source) {
+  const char* marker = strstr(source, "// repeat ");
+  long count = 1;
+  const char* body = source;
+  if (marker != NULL) {
+    count = strtol(marker + 10, NULL, 10);
+    body = strchr(marker, '\n');
+    body = body != NULL ? body + 1 : marker + strlen(marker);
+  } else {
+    marker = source;
+  }
+
+  size_t prelude_length = (size_t)(marker - source);
+  size_t body_length = strlen(body);
+  char* program = malloc(prelude_length + body_length * (size_t)count + 1);
+  if (program == NULL) {
+    return NULL;
+  }
+  memcpy(program, source, prelude_length);
+  char* end = program + prelude_length;
+  for (long i = 0; i < count; i++) {
+    memcpy(end, body, body_length);
+    end += body_length;
+  }
+  *end = '\0';
+  return program;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: sequences program.lox...\n");
+    return 64;
+  }
+  FILE* null = fopen("/dev/null", "w");
+  if (null == NULL) {
+    return 1;
+  }
+
+  Profile profile;
+  profile_init(&profile, system_allocator());
+  for (int i = 1; i < argc; i++) {
+    char* source = read_file(argv[i]);
+    char* program = source != NULL ? unroll(source) : NULL;
+    if (program == NULL) {
+      fprintf(stderr, "error: couldn't read \"%s\"\n", argv[i]);
+      return 1;
+    }
+
+    VM vm;
+    vm_init(&vm, system_allocator());
+    vm.output.stream = null;
+    vm.profile = &profile;
+    if (interpret(&vm, program) != INTERPRET_OK) {
+      fprintf(stderr, "error: \"%s\" failed\n", argv[i]);
+      return 1;
+    }
+    vm_free(&vm);
+    free(program);
+    free(source);
+  }
+
+  printf("%d programs\n", argc - 1);
+  profile_report(&profile, stdout);
+  profile_free(&profile);
+  fclose(null);
+  return 0;
+}
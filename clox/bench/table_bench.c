@@ -0,0 +1,255 @@
+// Micro-benchmarks for the hash table, against the linear-probing table it
+// replaced, at several load factors. Build and run with `make bench-table`.
+//
+// table.c is included directly so that tables can be sized up front.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "table.c"
+
+#define CAPACITY (1 << 16)
+#define REPEAT 20
+
+/* ---- Linear Probing Baseline ---- */
+
+// The previous table: one array of entries, linear probing, tombstones
+// marked by a NULL key with a non-nil value. Tombstones count towards the
+// load, and the table doubles whenever it passes 3/4 full.
+typedef struct {
+  size_t count;
+  size_t capacity;
+  Entry* entries;
+} LinearTable;
+
+static Entry* linear_find(Entry* entries, size_t capacity, ObjString* key) {
+  size_t mask = capacity - 1;
+  Entry* tombstone = NULL;
+  for (size_t index = key->hash & mask;; index = (index + 1) & mask) {
+    Entry* entry = &entries[index];
+    if (entry->key == key) {
+      return entry;
+    }
+    if (entry->key == NULL) {
+      if (IS_NIL(entry->value)) {
+        return tombstone != NULL ? tombstone : entry;
+      }
+      if (tombstone == NULL) {
+        tombstone = entry;
+      }
+    }
+  }
+}
+
+static void linear_resize(LinearTable* table, size_t capacity) {
+  Entry* entries = malloc(capacity * sizeof(Entry));
+  for (size_t i = 0; i < capacity; i++) {
+    entries[i].key = NULL;
+    entries[i].value = NIL_VALUE();
+  }
+
+  table->count = 0;
+  for (size_t i = 0; i < table->capacity; i++) {
+    Entry* entry = &table->entries[i];
+    if (entry->key != NULL) {
+      *linear_find(entries, capacity, entry->key) = *entry;
+      table->count++;
+    }
+  }
+
+  free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+static bool linear_get(LinearTable* table, ObjString* key, Value* value) {
+  Entry* entry = linear_find(table->entries, table->capacity, key);
+  if (entry->key == NULL) {
+    return false;
+  }
+  *value = entry->value;
+  return true;
+}
+
+static void linear_set(LinearTable* table, ObjString* key, Value value) {
+  if ((double)(table->count + 1) > (double)table->capacity * 0.75) {
+    linear_resize(table, table->capacity * 2);
+  }
+  Entry* entry = linear_find(table->entries, table->capacity, key);
+  if (entry->key == NULL && IS_NIL(entry->value)) {
+    table->count++;
+  }
+  entry->key = key;
+  entry->value = value;
+}
+
+static void linear_delete(LinearTable* table, ObjString* key) {
+  Entry* entry = linear_find(table->entries, table->capacity, key);
+  if (entry->key != NULL) {
+    entry->key = NULL;
+    entry->value = BOOL_VALUE(true);
+  }
+}
+
+/* ---- Benchmarks ---- */
+
+static ObjString** keys;
+static ObjString** missing;
+static volatile double sink;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void make_keys(VM* vm, size_t count) {
+  keys = malloc(count * sizeof(ObjString*));
+  missing = malloc(count * sizeof(ObjString*));
+  char buffer[32];
+  for (size_t i = 0; i < count; i++) {
+    int length = sprintf(buffer, "key_%zu", i);
+    keys[i] = string_copy(vm, buffer, (size_t)length);
+    length = sprintf(buffer, "missing_%zu", i);
+    missing[i] = string_copy(vm, buffer, (size_t)length);
+  }
+
+  // Shuffle so lookups don't follow insertion order
+  srand(1);
+  for (size_t i = count - 1; i > 0; i--) {
+    size_t j = (size_t)rand() % (i + 1);
+    ObjString* key = keys[i];
+    keys[i] = keys[j];
+    keys[j] = key;
+  }
+}
+
+static void report(const char* name, double load, const char* op,
+                   double elapsed, size_t operations) {
+  printf("%-8s %5.3f  %-8s %7.2f ns/op\n", name, load, op,
+         elapsed / (double)operations);
+}
+
+static void bench_swiss(double load, size_t count) {
+  Table table;
+  table_init(&table, system_allocator());
+  resize(&table, CAPACITY);
+  for (size_t i = 0; i < count; i++) {
+    table_set(&table, keys[i], NUMBER_VALUE((double)i));
+  }
+
+  Value value = NIL_VALUE();
+  double sum = 0;
+  double start = now();
+  for (int r = 0; r < REPEAT; r++) {
+    for (size_t i = 0; i < count; i++) {
+      table_get(&table, keys[i], &value);
+      sum += AS_NUMBER(value);
+    }
+  }
+  report("swiss", load, "hit", now() - start, REPEAT * count);
+
+  size_t found = 0;
+  start = now();
+  for (int r = 0; r < REPEAT; r++) {
+    for (size_t i = 0; i < count; i++) {
+      found += (size_t)table_get(&table, missing[i], &value);
+    }
+  }
+  report("swiss", load, "miss", now() - start, REPEAT * count);
+
+  // Delete and reinsert each key in turn, which leaves tombstones behind
+  start = now();
+  for (int r = 0; r < REPEAT; r++) {
+    for (size_t i = 0; i < count; i++) {
+      table_delete(&table, keys[i]);
+      table_set(&table, missing[i], NIL_VALUE());
+      table_delete(&table, missing[i]);
+      table_set(&table, keys[i], NUMBER_VALUE((double)i));
+    }
+  }
+  report("swiss", load, "churn", now() - start, REPEAT * count * 4);
+  printf("%-8s %5.3f  %zu slots after churn\n", "swiss", load, table.capacity);
+
+  sink = sum + (double)found;
+  table_free(&table);
+}
+
+static void bench_linear(double load, size_t count) {
+  LinearTable table = {0};
+  linear_resize(&table, CAPACITY);
+  for (size_t i = 0; i < count; i++) {
+    linear_set(&table, keys[i], NUMBER_VALUE((double)i));
+  }
+
+  Value value = NIL_VALUE();
+  double sum = 0;
+  double start = now();
+  for (int r = 0; r < REPEAT; r++) {
+    for (size_t i = 0; i < count; i++) {
+      linear_get(&table, keys[i], &value);
+      sum += AS_NUMBER(value);
+    }
+  }
+  report("linear", load, "hit", now() - start, REPEAT * count);
+
+  size_t found = 0;
+  start = now();
+  for (int r = 0; r < REPEAT; r++) {
+    for (size_t i = 0; i < count; i++) {
+      found += (size_t)linear_get(&table, missing[i], &value);
+    }
+  }
+  report("linear", load, "miss", now() - start, REPEAT * count);
+
+  start = now();
+  for (int r = 0; r < REPEAT; r++) {
+    for (size_t i = 0; i < count; i++) {
+      linear_delete(&table, keys[i]);
+      linear_set(&table, missing[i], NIL_VALUE());
+      linear_delete(&table, missing[i]);
+      linear_set(&table, keys[i], NUMBER_VALUE((double)i));
+    }
+  }
+  report("linear", load, "churn", now() - start, REPEAT * count * 4);
+  printf("%-8s %5.3f  %zu slots after churn\n", "linear", load,
+         table.capacity);
+
+  sink = sum + (double)found;
+  free(table.entries);
+}
+
+int main(void) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  size_t max_count = CAPACITY - CAPACITY / 8;
+  make_keys(&vm, max_count);
+
+  printf("%d slots, %s\n\n", CAPACITY,
+#ifdef SIMD_SSE2
+         "SSE2 group probing"
+#else
+         "scalar group probing"
+#endif
+  );
+
+  const double loads[] = {0.25, 0.5, 0.75, 0.875};
+  for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+    size_t count = (size_t)(loads[i] * CAPACITY) - 1;
+    bench_swiss(loads[i], count);
+    // The baseline never fills past 3/4
+    if (loads[i] <= 0.75) {
+      bench_linear(loads[i], count);
+    }
+    printf("\n");
+  }
+
+  free(keys);
+  free(missing);
+  vm_free(&vm);
+  return 0;
+}
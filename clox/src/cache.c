@@ -0,0 +1,478 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "memory.h"
+#include "object.h"
+
+// File layout, in native byte order:
+//
+//   CacheHeader
+//   uint8_t  code[code_count]
+//   uint64_t lines[line_count][2]     (offset, line)
+//   constants[constant_count]         (uint8_t type, then its payload)
+//   globals[global_count]             (names of the compiling VM's slots)
+//
+// Numbers are stored as a double, strings (and global names) as a uint64_t
+// length followed by the characters.
+//
+// The code section is used in place from the mapped file. Global slots in
+// it are the compiling VM's; if the loading VM numbers them differently, the
+// operands are patched as the file is loaded.
+//
+// Nothing in the file is trusted: the code is verified before it is used,
+// and max_stack is recomputed from it. It is only written for tools that
+// read the file.
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t source_hash;
+  uint64_t code_count;
+  uint64_t line_count;
+  uint64_t constant_count;
+  uint64_t global_count;
+  uint64_t max_stack;
+} CacheHeader;
+
+typedef enum {
+  CONSTANT_NUMBER,
+  CONSTANT_STRING,
+} ConstantType;
+
+static const char MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+uint64_t cache_hash_source(const char* source, size_t length) {
+  // FNV-1a
+  uint64_t hash = UINT64_C(14695981039346656037);
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)source[i];
+    hash *= UINT64_C(1099511628211);
+  }
+  return hash;
+}
+
+char* cache_path(const char* source_path) {
+  // script.lox -> script.loxc, anything else gets ".loxc" appended
+  size_t length = strlen(source_path);
+  bool has_extension =
+      length >= 4 && strcmp(source_path + length - 4, ".lox") == 0;
+  const char* suffix = has_extension ? "c" : ".loxc";
+
+  char* path = malloc(length + strlen(suffix) + 1);
+  if (path == NULL) {
+    return NULL;
+  }
+  strcpy(path, source_path);
+  strcat(path, suffix);
+  return path;
+}
+
+/* ---- Writing ---- */
+
+static bool write_uint64(FILE* f, uint64_t n) {
+  return fwrite(&n, sizeof(n), 1, f) == 1;
+}
+
+static bool write_string(FILE* f, ObjString* string) {
+  return write_uint64(f, string->length) &&
+         fwrite(string->chars, 1, string->length, f) == string->length;
+}
+
+static bool write_constant(FILE* f, Value value) {
+  if (IS_NUMBER(value)) {
+    uint8_t type = CONSTANT_NUMBER;
+    double number = AS_NUMBER(value);
+    return fwrite(&type, sizeof(type), 1, f) == 1 &&
+           fwrite(&number, sizeof(number), 1, f) == 1;
+  }
+  if (IS_STRING(value)) {
+    uint8_t type = CONSTANT_STRING;
+    ObjString* string = AS_STRING(value);
+    return fwrite(&type, sizeof(type), 1, f) == 1 &&
+           write_string(f, string);
+  }
+  // Other values are never stored in the constant pool
+  return false;
+}
+
+static bool write_chunk(FILE* f, VM* vm, Chunk* chunk,
+                        uint64_t source_hash) {
+  CacheHeader header = {
+      .version = CACHE_VERSION,
+      .source_hash = source_hash,
+      .code_count = chunk->count,
+      .line_count = chunk->line_count,
+      .constant_count = chunk->constants.count,
+      .global_count = vm->globals.count,
+      .max_stack = chunk->max_stack,
+  };
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+
+  if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+      fwrite(chunk->code, sizeof(uint8_t), chunk->count, f) != chunk->count) {
+    return false;
+  }
+
+  for (size_t i = 0; i < chunk->line_count; i++) {
+    if (!write_uint64(f, chunk->lines[i].offset) ||
+        !write_uint64(f, chunk->lines[i].line)) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < chunk->constants.count; i++) {
+    if (!write_constant(f, chunk->constants.values[i])) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < vm->globals.count; i++) {
+    if (!write_string(f, vm->globals.names[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool cache_write(VM* vm, Chunk* chunk, uint64_t source_hash, const char* path) {
+  // Write to a temporary file and rename it, so concurrent readers never
+  // see a partially written cache
+  size_t length = strlen(path);
+  char* tmp_path = malloc(length + sizeof(".tmp"));
+  if (tmp_path == NULL) {
+    return false;
+  }
+  strcpy(tmp_path, path);
+  strcat(tmp_path, ".tmp");
+
+  FILE* f = fopen(tmp_path, "wb");
+  if (f == NULL) {
+    free(tmp_path);
+    return false;
+  }
+
+  bool ok = write_chunk(f, vm, chunk, source_hash);
+  ok = (fclose(f) == 0) && ok;
+  ok = ok && (rename(tmp_path, path) == 0);
+  if (!ok) {
+    remove(tmp_path);
+  }
+
+  free(tmp_path);
+  return ok;
+}
+
+/* ---- Loading ---- */
+
+typedef struct {
+  const uint8_t* current;
+  const uint8_t* end;
+} Reader;
+
+static bool read_bytes(Reader* reader, void* dest, size_t size) {
+  if ((size_t)(reader->end - reader->current) < size) {
+    return false;
+  }
+  memcpy(dest, reader->current, size);
+  reader->current += size;
+  return true;
+}
+
+static ObjString* read_string(VM* vm, Reader* reader) {
+  // Interned straight from the mapped file
+  uint64_t length;
+  if (!read_bytes(reader, &length, sizeof(length)) ||
+      (uint64_t)(reader->end - reader->current) < length) {
+    return NULL;
+  }
+  ObjString* string =
+      string_copy(vm, (const char*)reader->current, (size_t)length);
+  reader->current += length;
+  return string;
+}
+
+// Rewrites the global slot operands in `chunk` from the file's numbering to
+// the VM's. `slots` maps each file slot to a VM slot.
+static bool patch_globals(Chunk* chunk, const size_t* slots, size_t count) {
+  size_t offset = 0;
+  while (offset < chunk->count) {
+    size_t size = chunk_instruction_size(chunk, offset);
+    if (size > chunk->count - offset) {
+      return false;
+    }
+
+    uint8_t* code = &chunk->code[offset];
+    if (code[0] == OP_GET_GLOBAL || code[0] == OP_DEFINE_GLOBAL ||
+        code[0] == OP_SET_GLOBAL || code[0] == OP_SET_GLOBAL_POP) {
+      size_t slot = (size_t)code[1] | (size_t)code[2] << 8;
+      if (slot >= count) {
+        return false;
+      }
+      code[1] = (uint8_t)(slots[slot] & 0xff);
+      code[2] = (uint8_t)(slots[slot] >> 8);
+    }
+    offset += size;
+  }
+  return true;
+}
+
+static bool read_globals(VM* vm, Reader* reader, uint64_t count,
+                         Chunk* chunk) {
+  if (count == 0) {
+    return true;
+  }
+  if (count > GLOBAL_MAX + 1) {
+    return false;
+  }
+
+  size_t* slots = malloc((size_t)count * sizeof(size_t));
+  if (slots == NULL) {
+    return false;
+  }
+
+  bool identity = true;
+  bool ok = true;
+  for (size_t i = 0; ok && i < count; i++) {
+    ObjString* name = read_string(vm, reader);
+    slots[i] = (name == NULL) ? SIZE_MAX : vm_global_slot(vm, name);
+    ok = slots[i] <= GLOBAL_MAX;
+    identity = identity && slots[i] == i;
+  }
+
+  // Scripts run in a fresh VM usually get the same numbering
+  if (ok && !identity) {
+    ok = patch_globals(chunk, slots, (size_t)count);
+  }
+
+  free(slots);
+  return ok;
+}
+
+// Values each instruction pops, and then pushes
+static const struct {
+  uint8_t pops;
+  uint8_t pushes;
+} stack_effects[OPCODE_COUNT] = {
+    [OP_CONSTANT] = {0, 1},          [OP_CONSTANT_LONG] = {0, 1},
+    [OP_NIL] = {0, 1},               [OP_TRUE] = {0, 1},
+    [OP_FALSE] = {0, 1},             [OP_POP] = {1, 0},
+    [OP_GET_GLOBAL] = {0, 1},        [OP_DEFINE_GLOBAL] = {1, 0},
+    [OP_SET_GLOBAL] = {1, 1},        [OP_NEGATE] = {1, 1},
+    [OP_ADD] = {2, 1},               [OP_SUBTRACT] = {2, 1},
+    [OP_MULTIPLY] = {2, 1},          [OP_DIVIDE] = {2, 1},
+    [OP_PRINT] = {1, 0},             [OP_RETURN] = {0, 0},
+    [OP_CONSTANT_ADD] = {1, 1},      [OP_CONSTANT_SUBTRACT] = {1, 1},
+    [OP_CONSTANT_MULTIPLY] = {1, 1}, [OP_CONSTANT_DIVIDE] = {1, 1},
+    [OP_SET_GLOBAL_POP] = {1, 0},    [OP_ADD_INT] = {2, 1},
+    [OP_ADD_NUM] = {2, 1},           [OP_SUBTRACT_INT] = {2, 1},
+    [OP_SUBTRACT_NUM] = {2, 1},      [OP_MULTIPLY_INT] = {2, 1},
+    [OP_MULTIPLY_NUM] = {2, 1},      [OP_DIVIDE_NUM] = {2, 1},
+};
+
+// Checks that run() can execute the code without reading or writing out of
+// bounds: every opcode is known, every operand is within its table and of
+// the type its instruction expects, nothing pops an empty stack, and the
+// code ends in OP_RETURN. The stack depth the
+// code reaches is recomputed rather than taken from the file. Lox has no
+// jumps yet, so the code runs straight through.
+static bool verify_code(Chunk* chunk, size_t global_count) {
+  if (chunk->line_count == 0) {
+    return false;
+  }
+  for (size_t i = 1; i < chunk->line_count; i++) {
+    if (chunk->lines[i].offset <= chunk->lines[i - 1].offset) {
+      return false;
+    }
+  }
+
+  size_t depth = 0;
+  size_t max_stack = 0;
+  size_t last = SIZE_MAX;
+  for (size_t offset = 0; offset < chunk->count;) {
+    uint8_t* code = &chunk->code[offset];
+    if (code[0] >= OPCODE_COUNT) {
+      return false;
+    }
+    size_t size = chunk_instruction_size(chunk, offset);
+    if (size > chunk->count - offset) {
+      return false;
+    }
+
+    switch (code[0]) {
+      case OP_CONSTANT:
+        if (code[1] >= chunk->constants.count) {
+          return false;
+        }
+        break;
+      case OP_CONSTANT_ADD:
+      case OP_CONSTANT_SUBTRACT:
+      case OP_CONSTANT_MULTIPLY:
+      case OP_CONSTANT_DIVIDE:
+        // run() relies on the compiler only fusing number constants
+        if (code[1] >= chunk->constants.count ||
+            !IS_NUMBER(chunk->constants.values[code[1]])) {
+          return false;
+        }
+        break;
+      case OP_CONSTANT_LONG: {
+        size_t constant =
+            (size_t)code[1] | (size_t)code[2] << 8 | (size_t)code[3] << 16;
+        if (constant >= chunk->constants.count) {
+          return false;
+        }
+        break;
+      }
+      case OP_GET_GLOBAL:
+      case OP_DEFINE_GLOBAL:
+      case OP_SET_GLOBAL:
+      case OP_SET_GLOBAL_POP:
+        if (((size_t)code[1] | (size_t)code[2] << 8) >= global_count) {
+          return false;
+        }
+        break;
+      default:
+        break;
+    }
+
+    size_t pops = stack_effects[code[0]].pops;
+    if (depth < pops) {
+      return false;
+    }
+    depth = depth - pops + stack_effects[code[0]].pushes;
+    if (depth > max_stack) {
+      max_stack = depth;
+    }
+    last = offset;
+    offset += size;
+  }
+
+  if (last == SIZE_MAX || chunk->code[last] != OP_RETURN) {
+    return false;
+  }
+  chunk->max_stack = max_stack;
+  return true;
+}
+
+static bool read_chunk(VM* vm, Reader* reader, uint64_t source_hash,
+                       Chunk* chunk) {
+  CacheHeader header;
+  if (!read_bytes(reader, &header, sizeof(header)) ||
+      memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != CACHE_VERSION || header.source_hash != source_hash) {
+    return false;
+  }
+
+  // Code is used in place
+  if ((uint64_t)(reader->end - reader->current) < header.code_count) {
+    return false;
+  }
+  chunk->code = (uint8_t*)reader->current;
+  chunk->count = (size_t)header.code_count;
+  reader->current += header.code_count;
+
+  for (uint64_t i = 0; i < header.line_count; i++) {
+    uint64_t offset, line;
+    if (!read_bytes(reader, &offset, sizeof(offset)) ||
+        !read_bytes(reader, &line, sizeof(line)) ||
+        offset >= header.code_count ||
+        !chunk_add_line(chunk, (size_t)offset, (size_t)line)) {
+      return false;
+    }
+  }
+
+  for (uint64_t i = 0; i < header.constant_count; i++) {
+    uint8_t type;
+    if (!read_bytes(reader, &type, sizeof(type))) {
+      return false;
+    }
+    switch (type) {
+      case CONSTANT_NUMBER: {
+        // Stored as doubles, and made integers again as the compiler would
+        double number;
+        if (!read_bytes(reader, &number, sizeof(number)) ||
+            chunk_add_constant(chunk, value_from_double(number)) == SIZE_MAX) {
+          return false;
+        }
+        break;
+      }
+      case CONSTANT_STRING: {
+        ObjString* string = read_string(vm, reader);
+        if (string == NULL ||
+            chunk_add_constant(chunk, OBJ_VALUE(string)) == SIZE_MAX) {
+          return false;
+        }
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+
+  // Slot operands are checked in the file's numbering, before they are
+  // patched to the VM's
+  return header.global_count <= GLOBAL_MAX + 1 &&
+         verify_code(chunk, (size_t)header.global_count) &&
+         read_globals(vm, reader, header.global_count, chunk) &&
+         reader->current == reader->end;
+}
+
+bool cache_load(VM* vm, const char* path, uint64_t source_hash, Chunk* chunk,
+                CacheMapping* mapping) {
+  mapping->base = NULL;
+  mapping->size = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+
+  // A private writable mapping lets the VM patch code in place without
+  // touching the file; pages are only copied if they are written to.
+  size_t size = (size_t)st.st_size;
+  void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+
+  mapping->base = base;
+  mapping->size = size;
+
+  // Interning a string can run the collector, which must see the constants
+  // loaded so far
+  Chunk* enclosing = vm->chunk;
+  vm->chunk = chunk;
+  Reader reader = {.current = base, .end = (uint8_t*)base + size};
+  bool ok = read_chunk(vm, &reader, source_hash, chunk);
+  vm->chunk = enclosing;
+  if (!ok) {
+    cache_unload(chunk, mapping);
+  }
+  return ok;
+}
+
+void cache_unload(Chunk* chunk, CacheMapping* mapping) {
+  // The code array belongs to the mapping, not to the chunk
+  chunk->code = NULL;
+  chunk->count = 0;
+  chunk_free(chunk);
+
+  if (mapping->base != NULL) {
+    munmap(mapping->base, mapping->size);
+    mapping->base = NULL;
+    mapping->size = 0;
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include "chunk.h"
+#include "vm.h"
+
+// Compiled chunks can be saved to a bytecode cache file (".loxc") next to
+// their source, and loaded back without scanning or compiling. A cache file
+// is only used if it was compiled from a source with the same hash.
+
+// Bump whenever the instruction set or the file layout changes
+#define CACHE_VERSION 6
+
+typedef struct {
+  void* base;
+  size_t size;
+} CacheMapping;
+
+uint64_t cache_hash_source(const char* source, size_t length);
+char* cache_path(const char* source_path);
+// Records the names of `vm`'s global slots, which `chunk` refers to
+bool cache_write(VM* vm, Chunk* chunk, uint64_t source_hash,
+                 const char* path);
+// String constants are interned in `vm`, and global slots renumbered to
+// match its own
+bool cache_load(VM* vm, const char* path, uint64_t source_hash, Chunk* chunk,
+                CacheMapping* mapping);
+void cache_unload(Chunk* chunk, CacheMapping* mapping);
+
+#endif
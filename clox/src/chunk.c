@@ -3,36 +3,120 @@
 #include "chunk.h"
 #include "memory.h"
 
-void chunk_init(Chunk* chunk) {
+void chunk_init(Chunk* chunk, Allocator* allocator) {
+  chunk->allocator = allocator;
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
+  chunk->line_count = 0;
+  chunk->line_capacity = 0;
   chunk->lines = NULL;
-  valuearray_init(&chunk->constants);
+  valuearray_init(&chunk->constants, allocator);
+  chunk->max_stack = 0;
 };
 
-void chunk_write(Chunk* chunk, uint8_t byte, size_t line) {
+bool chunk_write(Chunk* chunk, uint8_t byte, size_t line) {
   if (chunk->capacity < chunk->count + 1) {
     size_t old_capacity = chunk->capacity;
-    chunk->capacity = GROW_CAPACITY(old_capacity);
-    chunk->code =
-        GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
-    chunk->lines =
-        GROW_ARRAY(size_t, chunk->lines, old_capacity, chunk->capacity);
+    size_t capacity = GROW_CAPACITY(old_capacity);
+    uint8_t* code = GROW_ARRAY(chunk->allocator, MEMORY_CODE, uint8_t,
+                               chunk->code, old_capacity, capacity);
+    if (code == NULL) {
+      return false;
+    }
+    chunk->code = code;
+    chunk->capacity = capacity;
   }
+
+  // Only start a new run when the line changes
+  if (chunk->line_count == 0 ||
+      chunk->lines[chunk->line_count - 1].line != line) {
+    if (!chunk_add_line(chunk, chunk->count, line)) {
+      return false;
+    }
+  }
+
   chunk->code[chunk->count] = byte;
-  chunk->lines[chunk->count] = line;
   chunk->count++;
+  return true;
+}
+
+bool chunk_add_line(Chunk* chunk, size_t offset, size_t line) {
+  if (chunk->line_capacity < chunk->line_count + 1) {
+    size_t old_capacity = chunk->line_capacity;
+    size_t capacity = GROW_CAPACITY(old_capacity);
+    LineStart* lines = GROW_ARRAY(chunk->allocator, MEMORY_LINES, LineStart,
+                                  chunk->lines, old_capacity, capacity);
+    if (lines == NULL) {
+      return false;
+    }
+    chunk->lines = lines;
+    chunk->line_capacity = capacity;
+  }
+
+  chunk->lines[chunk->line_count] = (LineStart){.offset = offset, .line = line};
+  chunk->line_count++;
+  return true;
+}
+
+void chunk_truncate(Chunk* chunk, size_t count) {
+  if (count >= chunk->count) {
+    return;
+  }
+  chunk->count = count;
+  while (chunk->line_count > 0 &&
+         chunk->lines[chunk->line_count - 1].offset >= count) {
+    chunk->line_count--;
+  }
 }
 
 size_t chunk_add_constant(Chunk* chunk, Value value) {
-  valuearray_write(&chunk->constants, value);
+  if (!valuearray_write(&chunk->constants, value)) {
+    return SIZE_MAX;
+  }
   return chunk->constants.count - 1;
 }
 
+size_t chunk_get_line(Chunk* chunk, size_t offset) {
+  // Find the last run starting at or before offset
+  size_t low = 0;
+  size_t high = chunk->line_count;
+  while (high - low > 1) {
+    size_t mid = low + (high - low) / 2;
+    if (chunk->lines[mid].offset <= offset) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return chunk->lines[low].line;
+}
+
+size_t chunk_instruction_size(Chunk* chunk, size_t offset) {
+  switch (chunk->code[offset]) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_ADD:
+    case OP_CONSTANT_SUBTRACT:
+    case OP_CONSTANT_MULTIPLY:
+    case OP_CONSTANT_DIVIDE:
+      return 2;
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_POP:
+      return 3;
+    case OP_CONSTANT_LONG:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
 void chunk_free(Chunk* chunk) {
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(size_t, chunk->lines, chunk->capacity);
+  FREE_ARRAY(chunk->allocator, MEMORY_CODE, uint8_t, chunk->code,
+             chunk->capacity);
+  FREE_ARRAY(chunk->allocator, MEMORY_LINES, LineStart, chunk->lines,
+             chunk->line_capacity);
   valuearray_free(&chunk->constants);
-  chunk_init(chunk);
+  chunk_init(chunk, chunk->allocator);
 }
@@ -6,28 +6,81 @@
 
 typedef enum {
   OP_CONSTANT,
+  OP_CONSTANT_LONG,
   OP_NIL,
   OP_TRUE,
   OP_FALSE,
+  OP_POP,
+  OP_GET_GLOBAL,
+  OP_DEFINE_GLOBAL,
+  OP_SET_GLOBAL,
   OP_NEGATE,
   OP_ADD,
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
+  OP_PRINT,
   OP_RETURN,
+  // Superinstructions for the commonest sequences `make bench-sequences`
+  // finds. The compiler emits the first four for an arithmetic operator
+  // whose right operand is a number constant with a one-byte index, and
+  // OP_SET_GLOBAL_POP for an assignment whose value is discarded.
+  OP_CONSTANT_ADD,
+  OP_CONSTANT_SUBTRACT,
+  OP_CONSTANT_MULTIPLY,
+  OP_CONSTANT_DIVIDE,
+  OP_SET_GLOBAL_POP,
+  // Forms of the arithmetic opcodes specialized for integer (_INT) or
+  // double (_NUM) operands. The compiler never emits these: run() rewrites
+  // an instruction in place once it has seen what its operands are, and
+  // rewrites it back if they turn out to be anything else.
+  OP_ADD_INT,
+  OP_ADD_NUM,
+  OP_SUBTRACT_INT,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_INT,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  // Not an opcode
+  OPCODE_COUNT,
 } OpCode;
 
+// Start of a run of bytecode generated from the same source line
 typedef struct {
+  size_t offset;
+  size_t line;
+} LineStart;
+
+// Largest constant index encodable in OP_CONSTANT_LONG's 24-bit operand
+#define CONSTANT_LONG_MAX 0xffffff
+
+// Largest global variable slot encodable in a 16-bit operand
+#define GLOBAL_MAX 0xffff
+
+typedef struct {
+  Allocator* allocator;
   size_t count;
   size_t capacity;
   uint8_t* code;
-  size_t* lines;
+  // Run-length encoded line table, sorted by offset
+  size_t line_count;
+  size_t line_capacity;
+  LineStart* lines;
   ValueArray constants;
+  // Deepest the value stack gets while running this chunk
+  size_t max_stack;
 } Chunk;
 
-void chunk_init(Chunk* chunk);
-void chunk_write(Chunk* chunk, uint8_t byte, size_t line);
+// Functions that allocate return false (or SIZE_MAX for
+// chunk_add_constant()) when the chunk's allocator runs out of memory
+void chunk_init(Chunk* chunk, Allocator* allocator);
+bool chunk_write(Chunk* chunk, uint8_t byte, size_t line);
+bool chunk_add_line(Chunk* chunk, size_t offset, size_t line);
+void chunk_truncate(Chunk* chunk, size_t count);
 size_t chunk_add_constant(Chunk* chunk, Value value);
+size_t chunk_get_line(Chunk* chunk, size_t offset);
+// Size in bytes, with operands, of the instruction at `offset`
+size_t chunk_instruction_size(Chunk* chunk, size_t offset);
 void chunk_free(Chunk* chunk);
 
 #endif
@@ -5,7 +5,31 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// Represent values as NaN-boxed doubles (8 bytes) instead of tagged unions
+// (16 bytes). Can also be enabled with `CFLAGS=-DNAN_BOXING make`.
+// #define NAN_BOXING
+
+// Dispatch opcodes through a table of label addresses (GNU C "labels as
+// values", supported by gcc and clang) instead of a switch. Portable builds
+// can opt out with `CFLAGS=-DNO_THREADED_DISPATCH make`.
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+// Use SSE2 vector instructions where the target supports them (every x86-64
+// target does), with portable scalar code everywhere else. Can be turned off
+// with `CFLAGS=-DNO_SIMD make`.
+#if defined(__SSE2__) && !defined(NO_SIMD)
+#define SIMD_SSE2
+#endif
+
+// Disassemble every chunk after compiling it. Builds for timing turn this
+// off with `CFLAGS=-DNO_DEBUG_PRINT_CODE make`.
+#ifndef NO_DEBUG_PRINT_CODE
 #define DEBUG_PRINT_CODE
+#endif
 // #define DEBUG_TRACE_EXECUTION
+// Run a whole collection before every object allocation
+// #define DEBUG_STRESS_GC
 
 #endif
@@ -1,8 +1,11 @@
 #include <stdio.h>
-#include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -32,7 +35,32 @@ typedef struct {
   bool panic_mode;
 } Parser;
 
-typedef void (*ParseFn)(void);
+// Open-addressing index from constant values to their slot in the chunk's
+// constant pool, so repeated literals share a single entry
+typedef struct {
+  size_t count;
+  size_t capacity;
+  size_t* slots;
+} ConstantIndex;
+
+typedef struct {
+  VM* vm;
+  Scanner scanner;
+  Parser parser;
+  Chunk* chunk;
+  ConstantIndex constant_index;
+  // Offset of the most recently emitted constant load, and the size of the
+  // constant pool before it was emitted, used for constant folding
+  size_t last_constant;
+  size_t last_constant_pool_count;
+  // Offset of the most recently emitted OP_SET_GLOBAL, for fusing it with a
+  // following OP_POP
+  size_t last_assignment;
+  // Stack depth at the current point in the emitted code
+  size_t stack_depth;
+} Compiler;
+
+typedef void (*ParseFn)(Compiler* compiler, bool can_assign);
 
 typedef struct {
   ParseFn prefix;
@@ -40,20 +68,15 @@ typedef struct {
   Precedence precedence;
 } ParseRule;
 
-/* ---- Global State ---- */
-
-Parser parser;
-Chunk* compiling_chunk;
-
 /* ---- Helper Functions ---- */
 
-static Chunk* current_chunk(void) { return compiling_chunk; }
+static Chunk* current_chunk(Compiler* compiler) { return compiler->chunk; }
 
-static void error_at(Token* token, const char* message) {
-  if (parser.panic_mode) {
+static void error_at(Compiler* compiler, Token* token, const char* message) {
+  if (compiler->parser.panic_mode) {
     return;
   }
-  parser.panic_mode = true;
+  compiler->parser.panic_mode = true;
   fprintf(stderr, "[line %ld] Error", token->line);
 
   if (token->type == TOKEN_EOF) {
@@ -65,75 +88,384 @@ static void error_at(Token* token, const char* message) {
   }
 
   fprintf(stderr, ": %s\n", message);
-  parser.had_error = true;
+  compiler->parser.had_error = true;
 }
 
-static void error_at_current(const char* message) {
-  error_at(&parser.current, message);
+static void error_at_current(Compiler* compiler, const char* message) {
+  error_at(compiler, &compiler->parser.current, message);
 }
 
-static void error(const char* message) { error_at(&parser.previous, message); }
+static void error(Compiler* compiler, const char* message) {
+  error_at(compiler, &compiler->parser.previous, message);
+}
 
 /* ---- Scanner Interface ---- */
 
-static void advance(void) {
-  parser.previous = parser.current;
+static void advance(Compiler* compiler) {
+  compiler->parser.previous = compiler->parser.current;
 
   for (;;) {
-    parser.current = scan_token();
-    if (parser.current.type != TOKEN_ERROR) {
+    compiler->parser.current = scan_token(&compiler->scanner);
+    if (compiler->parser.current.type != TOKEN_ERROR) {
       break;
     }
 
-    error_at_current(parser.current.start);
+    error_at_current(compiler, compiler->parser.current.start);
   }
 }
 
-static void consume(TokenType type, const char* message) {
-  if (parser.current.type == type) {
-    advance();
+static void consume(Compiler* compiler, TokenType type, const char* message) {
+  if (compiler->parser.current.type == type) {
+    advance(compiler);
     return;
   }
 
-  error_at_current(message);
+  error_at_current(compiler, message);
+}
+
+static bool check(Compiler* compiler, TokenType type) {
+  return compiler->parser.current.type == type;
+}
+
+static bool match(Compiler* compiler, TokenType type) {
+  if (!check(compiler, type)) {
+    return false;
+  }
+  advance(compiler);
+  return true;
 }
 
 /* ---- Bytecode Emission ---- */
 
-static void emit_byte(uint8_t byte) {
-  chunk_write(current_chunk(), byte, (size_t)parser.previous.line);
+static void emit_byte(Compiler* compiler, uint8_t byte) {
+  if (!chunk_write(current_chunk(compiler), byte,
+                   (size_t)compiler->parser.previous.line)) {
+    error(compiler, "out of memory");
+  }
+}
+
+static void emit_bytes(Compiler* compiler, uint8_t byte1, uint8_t byte2) {
+  emit_byte(compiler, byte1);
+  emit_byte(compiler, byte2);
+}
+
+// Records the effect of the instruction just emitted on the VM's stack, so
+// the chunk knows the deepest point it reaches
+static void adjust_stack(Compiler* compiler, int effect) {
+  if (effect < 0) {
+    compiler->stack_depth -= (size_t)-effect;
+    return;
+  }
+
+  compiler->stack_depth += (size_t)effect;
+  Chunk* chunk = current_chunk(compiler);
+  if (compiler->stack_depth > chunk->max_stack) {
+    chunk->max_stack = compiler->stack_depth;
+  }
+}
+
+// OP_RETURN leaves the stack as it is, which is empty at the end of a script
+static void emit_return(Compiler* compiler) {
+  emit_byte(compiler, OP_RETURN);
+}
+
+/* ---- Constant Pool ---- */
+
+#define EMPTY_SLOT SIZE_MAX
+#define CONSTANT_INDEX_MAX_LOAD 0.5
+
+// Constants are deduplicated by identity, so 0 and -0 are kept apart.
+// Strings are interned, so equal strings are the same object.
+static bool constants_identical(Value a, Value b) {
+#ifdef NAN_BOXING
+  return a == b;
+#else
+  if (a.type != b.type) {
+    return false;
+  }
+  switch (a.type) {
+    case VAL_BOOL:
+      return a.as.boolean == b.as.boolean;
+    case VAL_NIL:
+    case VAL_UNDEFINED:
+      return true;
+    case VAL_DOUBLE:
+      return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+    case VAL_INTEGER:
+      return a.as.integer == b.as.integer;
+    case VAL_OBJ:
+      return a.as.obj == b.as.obj;
+  }
+  return false;
+#endif
+}
+
+static size_t hash_constant(Value value) {
+  uint64_t bits;
+#ifdef NAN_BOXING
+  bits = value;
+#else
+  if (IS_OBJ(value)) {
+    bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+  } else {
+    double number = IS_NUMBER(value) ? AS_NUMBER(value) : 0;
+    memcpy(&bits, &number, sizeof(double));
+  }
+  bits ^= (uint64_t)value.type;
+#endif
+  // Small integers and other short doubles only use the high bits, which a
+  // multiply never carries down into the bits we keep, so fold them in first.
+  // Fibonacci hashing then spreads them across the whole word.
+  bits ^= bits >> 32;
+  return (size_t)((bits * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
+
+static void constantindex_free(ConstantIndex* index, Allocator* allocator) {
+  FREE_ARRAY(allocator, MEMORY_COMPILER, size_t, index->slots, index->capacity);
+  index->count = 0;
+  index->capacity = 0;
+  index->slots = NULL;
+}
+
+static size_t* constantindex_find(ConstantIndex* index, ValueArray* pool,
+                                  Value value) {
+  size_t mask = index->capacity - 1;
+  for (size_t i = hash_constant(value) & mask;; i = (i + 1) & mask) {
+    size_t slot = index->slots[i];
+    if (slot == EMPTY_SLOT || constants_identical(pool->values[slot], value)) {
+      return &index->slots[i];
+    }
+  }
+}
+
+// Removes the entry for pool slot `slot`, which must still hold its value.
+// Later entries in the probe run shift back into the gap, so runs never
+// fill up with dead entries when folding discards constants line after line.
+static void constantindex_remove(ConstantIndex* index, ValueArray* pool,
+                                 size_t slot) {
+  if (index->capacity == 0) {
+    return;
+  }
+  size_t mask = index->capacity - 1;
+  size_t hole = hash_constant(pool->values[slot]) & mask;
+  while (index->slots[hole] != slot) {
+    if (index->slots[hole] == EMPTY_SLOT) {
+      return;
+    }
+    hole = (hole + 1) & mask;
+  }
+
+  for (size_t i = (hole + 1) & mask; index->slots[i] != EMPTY_SLOT;
+       i = (i + 1) & mask) {
+    // An entry can move back unless its home lies between the hole and it
+    size_t home = hash_constant(pool->values[index->slots[i]]) & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      index->slots[hole] = index->slots[i];
+      hole = i;
+    }
+  }
+  index->slots[hole] = EMPTY_SLOT;
+  index->count--;
 }
 
-static void emit_bytes(uint8_t byte1, uint8_t byte2) {
-  emit_byte(byte1);
-  emit_byte(byte2);
+static bool constantindex_grow(ConstantIndex* index, ValueArray* pool) {
+  size_t capacity = GROW_CAPACITY(index->capacity);
+  size_t* slots =
+      GROW_ARRAY(pool->allocator, MEMORY_COMPILER, size_t, NULL, 0, capacity);
+  if (slots == NULL) {
+    return false;
+  }
+  FREE_ARRAY(pool->allocator, MEMORY_COMPILER, size_t, index->slots,
+             index->capacity);
+  index->slots = slots;
+  index->capacity = capacity;
+  for (size_t i = 0; i < index->capacity; i++) {
+    index->slots[i] = EMPTY_SLOT;
+  }
+
+  index->count = 0;
+  for (size_t slot = 0; slot < pool->count; slot++) {
+    size_t* entry = constantindex_find(index, pool, pool->values[slot]);
+    if (*entry == EMPTY_SLOT) {
+      *entry = slot;
+      index->count++;
+    }
+  }
+  return true;
 }
 
-static void emit_return(void) { emit_byte(OP_RETURN); }
+static size_t make_constant(Compiler* compiler, Value value) {
+  Chunk* chunk = current_chunk(compiler);
+  ConstantIndex* index = &compiler->constant_index;
 
-static uint8_t make_constant(Value value) {
-  size_t constant = chunk_add_constant(current_chunk(), value);
-  if (constant > UINT8_MAX) {
-    error("too many constants in chunk");
+  if ((double)(index->count + 1) >
+          (double)index->capacity * CONSTANT_INDEX_MAX_LOAD &&
+      !constantindex_grow(index, &chunk->constants)) {
+    error(compiler, "out of memory");
     return 0;
   }
 
-  return (uint8_t)constant;
+  size_t* entry = constantindex_find(index, &chunk->constants, value);
+  if (*entry != EMPTY_SLOT) {
+    return *entry;
+  }
+
+  size_t constant = chunk_add_constant(chunk, value);
+  if (constant == SIZE_MAX) {
+    error(compiler, "out of memory");
+    return 0;
+  }
+  if (constant > CONSTANT_LONG_MAX) {
+    error(compiler, "too many constants in chunk");
+    return 0;
+  }
+
+  *entry = constant;
+  index->count++;
+  return constant;
+}
+
+static void emit_constant(Compiler* compiler, Value value) {
+  Chunk* chunk = current_chunk(compiler);
+  compiler->last_constant = chunk->count;
+  compiler->last_constant_pool_count = chunk->constants.count;
+
+  size_t constant = make_constant(compiler, value);
+  if (constant <= UINT8_MAX) {
+    emit_bytes(compiler, OP_CONSTANT, (uint8_t)constant);
+  } else {
+    // 24-bit little-endian operand
+    emit_byte(compiler, OP_CONSTANT_LONG);
+    emit_byte(compiler, (uint8_t)(constant & 0xff));
+    emit_byte(compiler, (uint8_t)((constant >> 8) & 0xff));
+    emit_byte(compiler, (uint8_t)((constant >> 16) & 0xff));
+  }
+  adjust_stack(compiler, 1);
+}
+
+/* ---- Global Variables ---- */
+
+// Resolves a global variable's name to its slot in the VM
+static size_t global_slot(Compiler* compiler, Token* name) {
+  ObjString* string =
+      string_copy(compiler->vm, name->start, (size_t)name->length);
+  size_t slot =
+      string == NULL ? SIZE_MAX : vm_global_slot(compiler->vm, string);
+  if (slot == SIZE_MAX) {
+    error(compiler, "out of memory");
+    return 0;
+  }
+  if (slot > GLOBAL_MAX) {
+    error(compiler, "too many global variables");
+    return 0;
+  }
+  return slot;
+}
+
+// Emits an instruction with a 16-bit little-endian global slot operand
+static void emit_global(Compiler* compiler, OpCode op, size_t slot) {
+  emit_byte(compiler, op);
+  emit_byte(compiler, (uint8_t)(slot & 0xff));
+  emit_byte(compiler, (uint8_t)((slot >> 8) & 0xff));
+}
+
+/* ---- Constant Folding ---- */
+
+// Returns true if the last instruction in the chunk is the constant load at
+// `offset`. When it is, the operand that was just compiled is a literal (or
+// an already folded expression).
+static bool ends_with_constant(Compiler* compiler, size_t offset) {
+  Chunk* chunk = current_chunk(compiler);
+  if (offset != compiler->last_constant || offset >= chunk->count) {
+    return false;
+  }
+  size_t length = chunk->code[offset] == OP_CONSTANT_LONG ? 4 : 2;
+  return offset + length == chunk->count;
+}
+
+// Reads the value loaded by the constant load at `offset` if it is a number.
+static bool constant_number(Compiler* compiler, size_t offset,
+                            double* number) {
+  Chunk* chunk = current_chunk(compiler);
+  uint8_t* operand = &chunk->code[offset + 1];
+  size_t constant = operand[0];
+  if (chunk->code[offset] == OP_CONSTANT_LONG) {
+    constant |= (size_t)operand[1] << 8 | (size_t)operand[2] << 16;
+  }
+
+  Value value = chunk->constants.values[constant];
+  if (!IS_NUMBER(value)) {
+    return false;
+  }
+
+  *number = AS_NUMBER(value);
+  return true;
+}
+
+// Replaces the constant loads from `offset` to the end of the chunk with a
+// single load of `number`. `pool_count` is the size of the constant pool
+// before the first of those loads was emitted: constants added since then
+// are only used by the replaced loads, and are discarded.
+static void replace_constants(Compiler* compiler, size_t offset,
+                              size_t pool_count, double number) {
+  Chunk* chunk = current_chunk(compiler);
+  for (size_t load = offset; load < chunk->count;) {
+    load += chunk->code[load] == OP_CONSTANT_LONG ? 4 : 2;
+    adjust_stack(compiler, -1);
+  }
+
+  for (size_t slot = chunk->constants.count; slot-- > pool_count;) {
+    constantindex_remove(&compiler->constant_index, &chunk->constants, slot);
+  }
+  chunk->constants.count = pool_count;
+  chunk_truncate(chunk, offset);
+  emit_constant(compiler, value_from_double(number));
+}
+
+/* ---- Superinstructions ---- */
+
+// Fuses the constant load at `offset`, the last instruction in the chunk,
+// into `fused` if it loads a number with a one-byte index. The fused
+// instruction takes the load's place and its operand.
+static bool fuse_constant(Compiler* compiler, size_t offset, OpCode fused) {
+  Chunk* chunk = current_chunk(compiler);
+  double number;
+  if (!ends_with_constant(compiler, offset) ||
+      chunk->code[offset] != OP_CONSTANT ||
+      !constant_number(compiler, offset, &number)) {
+    return false;
+  }
+
+  chunk->code[offset] = (uint8_t)fused;
+  // It no longer loads a constant that could be folded
+  compiler->last_constant = SIZE_MAX;
+  adjust_stack(compiler, -1);
+  return true;
 }
 
-static void emit_constant(Value value) {
-  emit_bytes(OP_CONSTANT, make_constant(value));
+// Emits an OP_POP, fused with the assignment before it if there is one
+static void emit_pop(Compiler* compiler) {
+  Chunk* chunk = current_chunk(compiler);
+  if (chunk->count >= 3 && compiler->last_assignment == chunk->count - 3) {
+    chunk->code[compiler->last_assignment] = OP_SET_GLOBAL_POP;
+    compiler->last_assignment = SIZE_MAX;
+  } else {
+    emit_byte(compiler, OP_POP);
+  }
+  adjust_stack(compiler, -1);
 }
 
 /* ---- Parse Rules Table ---- */
 
-static void parse_precedence(Precedence prec);
-static void expression(void);
-static void grouping(void);
-static void literal(void);
-static void unary(void);
-static void binary(void);
-static void number(void);
+static void parse_precedence(Compiler* compiler, Precedence prec);
+static void expression(Compiler* compiler);
+static void grouping(Compiler* compiler, bool can_assign);
+static void literal(Compiler* compiler, bool can_assign);
+static void unary(Compiler* compiler, bool can_assign);
+static void binary(Compiler* compiler, bool can_assign);
+static void number(Compiler* compiler, bool can_assign);
+static void string(Compiler* compiler, bool can_assign);
+static void variable(Compiler* compiler, bool can_assign);
 
 // Table defining parse rules for each token type
 static ParseRule rules[] = {
@@ -156,8 +488,8 @@ static ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = {NULL, NULL, PREC_NONE},
     [TOKEN_LESS] = {NULL, NULL, PREC_NONE},
     [TOKEN_LESS_EQUAL] = {NULL, NULL, PREC_NONE},
-    [TOKEN_IDENTIFIER] = {NULL, NULL, PREC_NONE},
-    [TOKEN_STRING] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
+    [TOKEN_STRING] = {string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, NULL, PREC_NONE},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
@@ -183,115 +515,308 @@ static ParseRule* get_rule(TokenType type) { return &rules[type]; }
 
 /* ---- Parsing Functions ---- */
 
-static void parse_precedence(Precedence prec) {
-  advance();
-  ParseFn prefix_rule = get_rule(parser.previous.type)->prefix;
+static void parse_precedence(Compiler* compiler, Precedence prec) {
+  advance(compiler);
+  ParseFn prefix_rule = get_rule(compiler->parser.previous.type)->prefix;
   if (prefix_rule == NULL) {
-    error("expected expression");
+    error(compiler, "expected expression");
     return;
   }
 
-  prefix_rule();
+  // Only the loosest expressions can be assignment targets, so that
+  // `a + b = c` isn't parsed as `a + (b = c)`
+  bool can_assign = prec <= PREC_ASSIGN;
+  prefix_rule(compiler, can_assign);
 
-  while (prec <= get_rule(parser.current.type)->precedence) {
-    advance();
-    ParseFn infix_rule = get_rule(parser.previous.type)->infix;
-    infix_rule();
+  while (prec <= get_rule(compiler->parser.current.type)->precedence) {
+    advance(compiler);
+    ParseFn infix_rule = get_rule(compiler->parser.previous.type)->infix;
+    infix_rule(compiler, can_assign);
+  }
+
+  if (can_assign && match(compiler, TOKEN_EQUAL)) {
+    error(compiler, "invalid assignment target");
   }
 }
 
-static void expression(void) { parse_precedence(PREC_ASSIGN); }
+static void expression(Compiler* compiler) {
+  parse_precedence(compiler, PREC_ASSIGN);
+}
 
-static void grouping(void) {
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "expected ')' after expression");
+static void grouping(Compiler* compiler, bool can_assign) {
+  (void)can_assign;
+  expression(compiler);
+  consume(compiler, TOKEN_RIGHT_PAREN, "expected ')' after expression");
 }
 
-static void literal(void) {
-  TokenType type = parser.previous.type;
+static void literal(Compiler* compiler, bool can_assign) {
+  (void)can_assign;
+  TokenType type = compiler->parser.previous.type;
 
   switch (type) {
     case TOKEN_NIL:
-      emit_byte(OP_NIL);
-      return;
+      emit_byte(compiler, OP_NIL);
+      break;
     case TOKEN_FALSE:
-      emit_byte(OP_FALSE);
-      return;
+      emit_byte(compiler, OP_FALSE);
+      break;
     case TOKEN_TRUE:
-      emit_byte(OP_TRUE);
-      return;
+      emit_byte(compiler, OP_TRUE);
+      break;
     default:
       return;  // unreachable
   }
+  adjust_stack(compiler, 1);
 }
 
-static void unary(void) {
-  TokenType op = parser.previous.type;
+static void unary(Compiler* compiler, bool can_assign) {
+  (void)can_assign;
+  TokenType op = compiler->parser.previous.type;
 
   // Compile the operand
-  parse_precedence(PREC_UNARY);
+  size_t operand = current_chunk(compiler)->count;
+  size_t pool_count = current_chunk(compiler)->constants.count;
+  parse_precedence(compiler, PREC_UNARY);
+
+  double value;
+  if (op == TOKEN_MINUS && ends_with_constant(compiler, operand) &&
+      constant_number(compiler, operand, &value)) {
+    replace_constants(compiler, operand, pool_count, -value);
+    return;
+  }
 
   // Emit the operator instruction
   switch (op) {
     case TOKEN_MINUS:
-      emit_byte(OP_NEGATE);
+      emit_byte(compiler, OP_NEGATE);
       break;
     default:
       return;  // unreachable
   }
 }
 
-static void binary(void) {
-  TokenType op = parser.previous.type;
+static void binary(Compiler* compiler, bool can_assign) {
+  (void)can_assign;
+  TokenType op = compiler->parser.previous.type;
 
+  // The left operand has already been compiled. If it is a constant, its
+  // load is the last instruction in the chunk.
+  size_t left = compiler->last_constant;
+  size_t pool_count = compiler->last_constant_pool_count;
+  bool left_is_constant = ends_with_constant(compiler, left);
+
+  size_t right = current_chunk(compiler)->count;
   ParseRule* rule = get_rule(op);
-  parse_precedence((Precedence)(rule->precedence + 1));
+  parse_precedence(compiler, (Precedence)(rule->precedence + 1));
+
+  double l, r;
+  if (left_is_constant && ends_with_constant(compiler, right) &&
+      constant_number(compiler, left, &l) &&
+      constant_number(compiler, right, &r)) {
+    // Folding uses the same double arithmetic as the VM, so results such as
+    // division by zero and negative zero are identical.
+    switch (op) {
+      case TOKEN_PLUS:
+        replace_constants(compiler, left, pool_count, l + r);
+        return;
+      case TOKEN_MINUS:
+        replace_constants(compiler, left, pool_count, l - r);
+        return;
+      case TOKEN_STAR:
+        replace_constants(compiler, left, pool_count, l * r);
+        return;
+      case TOKEN_SLASH:
+        replace_constants(compiler, left, pool_count, l / r);
+        return;
+      default:
+        break;
+    }
+  }
 
+  OpCode generic, fused;
   switch (op) {
     case TOKEN_PLUS:
-      emit_byte(OP_ADD);
+      generic = OP_ADD;
+      fused = OP_CONSTANT_ADD;
       break;
     case TOKEN_MINUS:
-      emit_byte(OP_SUBTRACT);
+      generic = OP_SUBTRACT;
+      fused = OP_CONSTANT_SUBTRACT;
       break;
     case TOKEN_STAR:
-      emit_byte(OP_MULTIPLY);
+      generic = OP_MULTIPLY;
+      fused = OP_CONSTANT_MULTIPLY;
       break;
     case TOKEN_SLASH:
-      emit_byte(OP_DIVIDE);
+      generic = OP_DIVIDE;
+      fused = OP_CONSTANT_DIVIDE;
       break;
     default:
       return;  // unreachable
   }
+
+  if (!fuse_constant(compiler, right, fused)) {
+    emit_byte(compiler, (uint8_t)generic);
+    adjust_stack(compiler, -1);
+  }
+}
+
+static void number(Compiler* compiler, bool can_assign) {
+  (void)can_assign;
+  Token* token = &compiler->parser.previous;
+  double value = number_parse(token->start, (size_t)token->length);
+  emit_constant(compiler, value_from_double(value));
+}
+
+static void string(Compiler* compiler, bool can_assign) {
+  (void)can_assign;
+  // Trim the quotes
+  Token* token = &compiler->parser.previous;
+  ObjString* value = string_copy(compiler->vm, token->start + 1,
+                                 (size_t)token->length - 2);
+  if (value == NULL) {
+    error(compiler, "out of memory");
+    return;
+  }
+  emit_constant(compiler, OBJ_VALUE(value));
+}
+
+static void named_variable(Compiler* compiler, Token name, bool can_assign) {
+  size_t slot = global_slot(compiler, &name);
+
+  if (can_assign && match(compiler, TOKEN_EQUAL)) {
+    expression(compiler);
+    compiler->last_assignment = current_chunk(compiler)->count;
+    emit_global(compiler, OP_SET_GLOBAL, slot);
+  } else {
+    emit_global(compiler, OP_GET_GLOBAL, slot);
+    adjust_stack(compiler, 1);
+  }
+}
+
+static void variable(Compiler* compiler, bool can_assign) {
+  named_variable(compiler, compiler->parser.previous, can_assign);
+}
+
+/* ---- Declarations and Statements ---- */
+
+static void declaration(Compiler* compiler);
+static void statement(Compiler* compiler);
+
+static void var_declaration(Compiler* compiler) {
+  consume(compiler, TOKEN_IDENTIFIER, "expected variable name");
+  size_t slot = global_slot(compiler, &compiler->parser.previous);
+
+  if (match(compiler, TOKEN_EQUAL)) {
+    expression(compiler);
+  } else {
+    emit_byte(compiler, OP_NIL);
+    adjust_stack(compiler, 1);
+  }
+  consume(compiler, TOKEN_SEMICOLON,
+          "expected ';' after variable declaration");
+
+  emit_global(compiler, OP_DEFINE_GLOBAL, slot);
+  adjust_stack(compiler, -1);
 }
 
-static void number(void) {
-  double value = strtod(parser.previous.start, NULL);
-  emit_constant(NUMBER_VALUE(value));
+static void expression_statement(Compiler* compiler) {
+  expression(compiler);
+  consume(compiler, TOKEN_SEMICOLON, "expected ';' after expression");
+  emit_pop(compiler);
+}
+
+static void print_statement(Compiler* compiler) {
+  expression(compiler);
+  consume(compiler, TOKEN_SEMICOLON, "expected ';' after value");
+  emit_byte(compiler, OP_PRINT);
+  adjust_stack(compiler, -1);
+}
+
+// Skips tokens until a likely statement boundary after a compile error, so
+// one mistake doesn't cause a cascade of errors
+static void synchronize(Compiler* compiler) {
+  compiler->parser.panic_mode = false;
+
+  while (compiler->parser.current.type != TOKEN_EOF) {
+    if (compiler->parser.previous.type == TOKEN_SEMICOLON) {
+      return;
+    }
+    switch (compiler->parser.current.type) {
+      case TOKEN_CLASS:
+      case TOKEN_FUN:
+      case TOKEN_VAR:
+      case TOKEN_FOR:
+      case TOKEN_IF:
+      case TOKEN_WHILE:
+      case TOKEN_PRINT:
+      case TOKEN_RETURN:
+        return;
+      default:
+        break;
+    }
+    advance(compiler);
+  }
+}
+
+static void declaration(Compiler* compiler) {
+  if (match(compiler, TOKEN_VAR)) {
+    var_declaration(compiler);
+  } else {
+    statement(compiler);
+  }
+
+  if (compiler->parser.panic_mode) {
+    synchronize(compiler);
+  }
+}
+
+static void statement(Compiler* compiler) {
+  if (match(compiler, TOKEN_PRINT)) {
+    print_statement(compiler);
+  } else {
+    expression_statement(compiler);
+  }
 }
 
 /* ---- Compiler Interface ---- */
 
-static void end_compiler(void) {
-  emit_return();
+static void end_compiler(Compiler* compiler) {
+  emit_return(compiler);
 #ifdef DEBUG_PRINT_CODE
-  if (!parser.had_error) {
-    disassemble_chunk(current_chunk(), "code");
+  if (!compiler->parser.had_error) {
+    disassemble_chunk(current_chunk(compiler), "code");
   }
 #endif
 }
 
-bool compile(const char* source, Chunk* chunk) {
-  scanner_init(source);
-  compiling_chunk = chunk;
-
-  parser.had_error = false;
-  parser.panic_mode = false;
-
-  advance();
-  expression();
-  consume(TOKEN_EOF, "expected end of expression");
+bool compile(VM* vm, const char* source, Chunk* chunk) {
+  // All compilation state is local, so independent sources can be compiled
+  // concurrently into different VMs
+  Compiler compiler_state = {
+      .vm = vm,
+      .chunk = chunk,
+      .last_constant = SIZE_MAX,
+      .last_assignment = SIZE_MAX,
+  };
+  Compiler* compiler = &compiler_state;
+  scanner_init(&compiler->scanner, source);
+
+  compiler->parser.had_error = false;
+  compiler->parser.panic_mode = false;
+
+  // Interning a string can run the collector, which must see the constants
+  // compiled so far
+  Chunk* enclosing = vm->chunk;
+  vm->chunk = chunk;
+
+  advance(compiler);
+  while (!match(compiler, TOKEN_EOF)) {
+    declaration(compiler);
+  }
 
-  end_compiler();
-  return !parser.had_error;
+  end_compiler(compiler);
+  constantindex_free(&compiler->constant_index, chunk->allocator);
+  vm->chunk = enclosing;
+  return !compiler->parser.had_error;
 }
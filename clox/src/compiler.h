@@ -2,7 +2,9 @@
 #define clox_compiler_h
 
 #include "chunk.h"
+#include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+// Compiles `source` into `chunk`. String literals are interned in the VM.
+bool compile(VM* vm, const char* source, Chunk* chunk);
 
 #endif
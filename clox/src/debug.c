@@ -2,6 +2,41 @@
 
 #include "debug.h"
 
+static const char* opcode_names[] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_NIL] = "OP_NIL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_CONSTANT_ADD] = "OP_CONSTANT_ADD",
+    [OP_CONSTANT_SUBTRACT] = "OP_CONSTANT_SUBTRACT",
+    [OP_CONSTANT_MULTIPLY] = "OP_CONSTANT_MULTIPLY",
+    [OP_CONSTANT_DIVIDE] = "OP_CONSTANT_DIVIDE",
+    [OP_SET_GLOBAL_POP] = "OP_SET_GLOBAL_POP",
+    [OP_ADD_INT] = "OP_ADD_INT",
+    [OP_ADD_NUM] = "OP_ADD_NUM",
+    [OP_SUBTRACT_INT] = "OP_SUBTRACT_INT",
+    [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+    [OP_MULTIPLY_INT] = "OP_MULTIPLY_INT",
+    [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+    [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+};
+
+const char* opcode_name(uint8_t opcode) {
+  return opcode < OPCODE_COUNT ? opcode_names[opcode] : NULL;
+}
+
 void disassemble_chunk(Chunk* chunk, const char* name) {
   printf("== %s ==\n", name);
   for (size_t offset = 0; offset < chunk->count;) {
@@ -23,38 +58,55 @@ static size_t constant_instruction(const char* name, Chunk* chunk,
   return offset + 2;
 }
 
+static size_t constant_long_instruction(const char* name, Chunk* chunk,
+                                        size_t offset) {
+  size_t constant = (size_t)chunk->code[offset + 1] |
+                    (size_t)chunk->code[offset + 2] << 8 |
+                    (size_t)chunk->code[offset + 3] << 16;
+  printf("%-16s %4lu '", name, constant);
+  value_print(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 4;
+}
+
+static size_t global_instruction(const char* name, Chunk* chunk,
+                                 size_t offset) {
+  size_t slot =
+      (size_t)chunk->code[offset + 1] | (size_t)chunk->code[offset + 2] << 8;
+  printf("%-16s %4lu\n", name, slot);
+  return offset + 3;
+}
+
 size_t disassemble_instruction(Chunk* chunk, size_t offset) {
   printf("%04lu ", offset);
 
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+  size_t line = chunk_get_line(chunk, offset);
+  if (offset > 0 && line == chunk_get_line(chunk, offset - 1)) {
     printf("   | ");
   } else {
-    printf("%4lu ", chunk->lines[offset]);
+    printf("%4lu ", line);
   }
 
   uint8_t instruction = chunk->code[offset];
+  const char* name = opcode_name(instruction);
   switch (instruction) {
     case OP_CONSTANT:
-      return constant_instruction("OP_CONSTANT", chunk, offset);
-    case OP_NIL:
-      return simple_instruction("OP_NIL", offset);
-    case OP_TRUE:
-      return simple_instruction("OP_TRUE", offset);
-    case OP_FALSE:
-      return simple_instruction("OP_FALSE", offset);
-    case OP_NEGATE:
-      return simple_instruction("OP_NEGATE", offset);
-    case OP_ADD:
-      return simple_instruction("OP_ADD", offset);
-    case OP_SUBTRACT:
-      return simple_instruction("OP_SUBTRACT", offset);
-    case OP_MULTIPLY:
-      return simple_instruction("OP_MULTIPLY", offset);
-    case OP_DIVIDE:
-      return simple_instruction("OP_DIVIDE", offset);
-    case OP_RETURN:
-      return simple_instruction("OP_RETURN", offset);
+    case OP_CONSTANT_ADD:
+    case OP_CONSTANT_SUBTRACT:
+    case OP_CONSTANT_MULTIPLY:
+    case OP_CONSTANT_DIVIDE:
+      return constant_instruction(name, chunk, offset);
+    case OP_CONSTANT_LONG:
+      return constant_long_instruction(name, chunk, offset);
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_POP:
+      return global_instruction(name, chunk, offset);
     default:
+      if (name != NULL) {
+        return simple_instruction(name, offset);
+      }
       printf("Unknown opcode %d\n", instruction);
       return offset + 1;
   }
@@ -5,5 +5,7 @@
 
 void disassemble_chunk(Chunk* chunk, const char* name);
 size_t disassemble_instruction(Chunk* chunk, size_t offset);
+// NULL if `opcode` isn't one
+const char* opcode_name(uint8_t opcode);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,306 @@
+#include <stdio.h>
+
+#include "gc.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+// Units of work (objects traced or swept) done between looks at the clock
+#define GC_CLOCK_INTERVAL 64
+
+/* ---- Heap Accounting ---- */
+
+static void* gc_reallocate(Allocator* self, void* pointer, size_t old_size,
+                           size_t new_size) {
+  GC* gc = (GC*)self;
+  void* result =
+      gc->parent->reallocate(gc->parent, pointer, old_size, new_size);
+  if (result != NULL || new_size == 0) {
+    gc->bytes_allocated += new_size - old_size;
+  }
+  return result;
+}
+
+void gc_init(GC* gc, Allocator* parent) {
+  // reallocate() records statistics for the wrapper, so the parent's own
+  // function is called directly to avoid counting everything twice
+  gc->allocator.reallocate = gc_reallocate;
+  gc->allocator.stats = parent->stats;
+  gc->allocator.suballocator = parent->suballocator;
+  gc->parent = parent;
+  gc->bytes_allocated = 0;
+  gc->next_gc = GC_HEAP_MIN;
+  gc->pause_target = GC_PAUSE_DEFAULT;
+  gc->state = GC_IDLE;
+  gc->black = true;
+  gc->gray = NULL;
+  gc->gray_count = 0;
+  gc->gray_capacity = 0;
+  gc->global_cursor = 0;
+  gc->sweep = NULL;
+  gc->stats = (GCStats){0};
+}
+
+void gc_free(GC* gc) {
+  FREE_ARRAY(&gc->allocator, MEMORY_GC, Obj*, gc->gray, gc->gray_capacity);
+  gc->gray = NULL;
+  gc->gray_count = 0;
+  gc->gray_capacity = 0;
+}
+
+/* ---- Marking ---- */
+
+static void blacken(VM* vm, Obj* object) {
+  (void)vm;
+  switch (object->type) {
+    case OBJ_STRING:
+      // No references
+      break;
+  }
+}
+
+void gc_gray(VM* vm, Obj* object) {
+  GC* gc = &vm->gc;
+  if (object->mark == gc->black) {
+    return;
+  }
+  object->mark = gc->black;
+
+  if (gc->gray_capacity < gc->gray_count + 1) {
+    size_t capacity = GROW_CAPACITY(gc->gray_capacity);
+    Obj** gray = GROW_ARRAY(&gc->allocator, MEMORY_GC, Obj*, gc->gray,
+                            gc->gray_capacity, capacity);
+    if (gray == NULL) {
+      // Trace it right away instead
+      blacken(vm, object);
+      return;
+    }
+    gc->gray = gray;
+    gc->gray_capacity = capacity;
+  }
+  gc->gray[gc->gray_count++] = object;
+}
+
+void gc_weak_barrier(VM* vm, Obj* object) {
+  GC* gc = &vm->gc;
+  if (gc->state == GC_MARK) {
+    gc_gray(vm, object);
+  } else if (gc->state == GC_SWEEP) {
+    // Still reachable through the weak reference, so the sweep hasn't freed
+    // it yet. Objects held weakly have no references to trace.
+    object->mark = gc->black;
+  }
+}
+
+static void mark_value(VM* vm, Value value) {
+  if (IS_OBJ(value)) {
+    gc_gray(vm, AS_OBJ(value));
+  }
+}
+
+static void start_cycle(VM* vm) {
+  vm->gc.state = GC_MARK;
+  vm->gc.global_cursor = 0;
+}
+
+// The stack and the current chunk change too often to be guarded by write
+// barriers, so they are scanned here, in one go. This is the only work that
+// ignores the pause target; it takes time in proportion to the stack depth
+// and the size of the constant pool.
+static void finish_marking(VM* vm) {
+  GC* gc = &vm->gc;
+  uint64_t start = clock_nanoseconds();
+  for (Value* slot = vm->stack; slot < vm->stack_top; slot++) {
+    mark_value(vm, *slot);
+  }
+  if (vm->chunk != NULL) {
+    for (size_t i = 0; i < vm->chunk->constants.count; i++) {
+      mark_value(vm, vm->chunk->constants.values[i]);
+    }
+  }
+  while (gc->gray_count > 0) {
+    blacken(vm, gc->gray[--gc->gray_count]);
+  }
+
+  uint64_t elapsed = clock_nanoseconds() - start;
+  gc->stats.total_final_mark += elapsed;
+  if (elapsed > gc->stats.max_final_mark) {
+    gc->stats.max_final_mark = elapsed;
+  }
+
+  gc->state = GC_SWEEP;
+  gc->sweep = &vm->objects;
+}
+
+static void mark_some(VM* vm, size_t budget) {
+  GC* gc = &vm->gc;
+  Globals* globals = &vm->globals;
+  for (size_t work = 0; work < budget; work++) {
+    if (gc->gray_count > 0) {
+      blacken(vm, gc->gray[--gc->gray_count]);
+    } else if (gc->global_cursor < globals->count) {
+      size_t slot = gc->global_cursor++;
+      gc_gray(vm, &globals->names[slot]->obj);
+      mark_value(vm, globals->values[slot]);
+    } else {
+      finish_marking(vm);
+      return;
+    }
+  }
+}
+
+/* ---- Sweeping ---- */
+
+static void finish_sweeping(GC* gc) {
+  // Every survivor is black, and becomes white for the next cycle
+  gc->black = !gc->black;
+  gc->state = GC_IDLE;
+  gc->sweep = NULL;
+  gc->next_gc = gc->bytes_allocated * GC_HEAP_GROW_FACTOR;
+  if (gc->next_gc < GC_HEAP_MIN) {
+    gc->next_gc = GC_HEAP_MIN;
+  }
+  gc->stats.cycles++;
+}
+
+static void sweep_some(VM* vm, size_t budget) {
+  // Objects allocated while sweeping are black and go on the front of the
+  // list, so whether or not the sweep reaches them, they survive
+  GC* gc = &vm->gc;
+  for (size_t work = 0; work < budget; work++) {
+    Obj* object = *gc->sweep;
+    if (object == NULL) {
+      finish_sweeping(gc);
+      return;
+    }
+
+    if (object->mark == gc->black) {
+      gc->sweep = &object->next;
+      continue;
+    }
+
+    *gc->sweep = object->next;
+    if (object->type == OBJ_STRING) {
+      // Strings that are only interned die, and leave the table as they go
+      table_delete(&vm->strings, (ObjString*)object);
+    }
+    size_t before = gc->bytes_allocated;
+    object_free(vm, object);
+    gc->stats.objects_freed++;
+    gc->stats.bytes_freed += before - gc->bytes_allocated;
+  }
+}
+
+/* ---- Pacing ---- */
+
+static void record_pause(GCStats* stats, uint64_t pause) {
+  stats->steps++;
+  stats->total_pause += pause;
+  if (pause > stats->max_pause) {
+    stats->max_pause = pause;
+  }
+
+  size_t bucket = 0;
+  while (bucket + 1 < GC_HISTOGRAM_BUCKETS &&
+         pause >= (UINT64_C(2) << bucket)) {
+    bucket++;
+  }
+  stats->pauses[bucket]++;
+}
+
+static void do_work(VM* vm, size_t budget) {
+  if (vm->gc.state == GC_MARK) {
+    mark_some(vm, budget);
+  } else {
+    sweep_some(vm, budget);
+  }
+}
+
+void gc_step(VM* vm) {
+  GC* gc = &vm->gc;
+  uint64_t start = clock_nanoseconds();
+  uint64_t elapsed;
+  if (gc->state == GC_IDLE) {
+    start_cycle(vm);
+  }
+
+  do {
+    do_work(vm, GC_CLOCK_INTERVAL);
+    elapsed = clock_nanoseconds() - start;
+  } while (gc->state != GC_IDLE && elapsed < gc->pause_target);
+
+  record_pause(&gc->stats, elapsed);
+}
+
+void gc_collect(VM* vm) {
+  GC* gc = &vm->gc;
+  uint64_t start = clock_nanoseconds();
+  if (gc->state == GC_IDLE) {
+    start_cycle(vm);
+  }
+
+  while (gc->state != GC_IDLE) {
+    do_work(vm, SIZE_MAX);
+  }
+
+  record_pause(&gc->stats, clock_nanoseconds() - start);
+}
+
+void gc_allocating(VM* vm) {
+#ifdef DEBUG_STRESS_GC
+  gc_collect(vm);
+#else
+  GC* gc = &vm->gc;
+  if (gc->state == GC_IDLE) {
+    if (gc->bytes_allocated >= gc->next_gc) {
+      gc_step(vm);
+    }
+  } else if (gc->bytes_allocated >= gc->next_gc * GC_HEAP_GROW_FACTOR) {
+    // Allocation is outrunning the collector
+    gc_collect(vm);
+  } else {
+    gc_step(vm);
+  }
+#endif
+}
+
+/* ---- Statistics ---- */
+
+// Upper bound, in nanoseconds, of the pauses in the histogram's `fraction`
+// quantile
+static double pause_quantile(const GCStats* stats, double fraction) {
+  size_t seen = 0;
+  for (size_t i = 0; i < GC_HISTOGRAM_BUCKETS; i++) {
+    seen += stats->pauses[i];
+    if ((double)seen >= fraction * (double)stats->steps) {
+      return (double)(UINT64_C(2) << i);
+    }
+  }
+  return (double)stats->max_pause;
+}
+
+void gcstats_print(const GCStats* stats, FILE* out) {
+  fprintf(out, "gc: %zu cycles, %zu steps, %zu objects (%zu bytes) freed\n",
+          stats->cycles, stats->steps, stats->objects_freed,
+          stats->bytes_freed);
+  if (stats->steps == 0) {
+    return;
+  }
+
+  fprintf(out, "  pause total %.3f ms, max %.3f us\n",
+          (double)stats->total_pause / 1e6, (double)stats->max_pause / 1e3);
+  fprintf(out, "  pause p50 < %.3f us, p90 < %.3f us, p99 < %.3f us\n",
+          pause_quantile(stats, 0.5) / 1e3, pause_quantile(stats, 0.9) / 1e3,
+          pause_quantile(stats, 0.99) / 1e3);
+  fprintf(out, "  final mark (not paced) total %.3f ms, max %.3f us\n",
+          (double)stats->total_final_mark / 1e6,
+          (double)stats->max_final_mark / 1e3);
+  for (size_t i = 0; i < GC_HISTOGRAM_BUCKETS; i++) {
+    if (stats->pauses[i] > 0) {
+      double low = i == 0 ? 0 : (double)(UINT64_C(1) << i);
+      fprintf(out, "  %12.3f - %12.3f us %12zu\n", low / 1e3,
+              (double)(UINT64_C(2) << i) / 1e3, stats->pauses[i]);
+    }
+  }
+}
@@ -0,0 +1,126 @@
+#ifndef clox_gc_h
+#define clox_gc_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "memory.h"
+#include "value.h"
+
+// Incremental tri-color mark-sweep collector.
+//
+// Objects are white (not reached yet), gray (reached, on the worklist, with
+// references still to trace) or black (reached and traced). Instead of a
+// color field, every object has a mark bit, and an object is black or gray
+// when its bit equals the collector's `black`. Flipping `black` at the end
+// of a cycle turns every survivor white again without touching it.
+//
+// A cycle starts once the VM's heap has grown past `next_gc`. From then on,
+// each object allocation does a slice of marking or sweeping work, which
+// stops once it has taken `pause_target` nanoseconds. The stack and the
+// running chunk's constants are scanned in one go when marking finishes, so
+// that step can overrun the target by the time the scan takes; it is timed
+// on its own in GCStats. Global variables are scanned a slice at a time.
+// Write barriers keep that sound:
+//
+// - Storing into a global grays the stored object.
+// - Finding an existing string in the (weak) intern table grays it while
+//   marking, and makes it black while sweeping, so code compiled mid-cycle
+//   can't resurrect a string the collector is about to free.
+//
+// The sweep removes each string it frees from the intern table, so clearing
+// the table's dead entries is spread across the sweep's slices too.
+//
+// Objects allocated during a cycle are black.
+
+// Heap size, in bytes, below which no cycle starts
+#define GC_HEAP_MIN (1024 * 1024)
+// A cycle starts when the heap reaches this many times what survived the
+// last one. If it reaches twice that before the cycle is over, the rest of
+// the cycle is done at once.
+#define GC_HEAP_GROW_FACTOR 2
+// Default pause target, in nanoseconds
+#define GC_PAUSE_DEFAULT 100000
+
+// Pause times are counted in power-of-two buckets: bucket i counts pauses of
+// [2^i, 2^(i+1)) nanoseconds, and bucket 0 also counts shorter ones
+#define GC_HISTOGRAM_BUCKETS 40
+
+typedef enum {
+  GC_IDLE,
+  GC_MARK,
+  GC_SWEEP,
+} GCState;
+
+typedef struct {
+  size_t cycles;
+  size_t steps;
+  size_t objects_freed;
+  size_t bytes_freed;
+  uint64_t total_pause;
+  uint64_t max_pause;
+  size_t pauses[GC_HISTOGRAM_BUCKETS];
+  // The final scan of the stack and constants, which isn't paced, is also
+  // part of one of the pauses above
+  uint64_t total_final_mark;
+  uint64_t max_final_mark;
+} GCStats;
+
+typedef struct {
+  // Wraps the VM's allocator to count the bytes it holds
+  Allocator allocator;
+  Allocator* parent;
+  size_t bytes_allocated;
+  size_t next_gc;
+  // The longest a step may run, in nanoseconds. Can be changed at any time.
+  uint64_t pause_target;
+
+  GCState state;
+  bool black;
+  // Worklist of gray objects
+  Obj** gray;
+  size_t gray_count;
+  size_t gray_capacity;
+  // Next global variable to scan while marking
+  size_t global_cursor;
+  // Link to the next object to sweep
+  Obj** sweep;
+
+  GCStats stats;
+} GC;
+
+typedef struct VM VM;
+
+// `gc->allocator` wraps `parent`; the VM allocates everything through it
+void gc_init(GC* gc, Allocator* parent);
+void gc_free(GC* gc);
+
+// Called before every object allocation
+void gc_allocating(VM* vm);
+// Does one slice of work, starting a cycle if none is running
+void gc_step(VM* vm);
+// Finishes the current cycle, or runs a whole one
+void gc_collect(VM* vm);
+
+// Grays `object` if it is white
+void gc_gray(VM* vm, Obj* object);
+// Read barrier, for `object` having been found through a weak reference
+void gc_weak_barrier(VM* vm, Obj* object);
+
+// Write barrier, for storing `value` somewhere the collector may have
+// scanned already
+#define GC_BARRIER(vm, value)                         \
+  do {                                                \
+    if ((vm)->gc.state == GC_MARK && IS_OBJ(value)) { \
+      gc_gray(vm, AS_OBJ(value));                     \
+    }                                                 \
+  } while (false)
+
+// The mark bit for newly allocated objects
+static inline bool gc_allocation_mark(const GC* gc) {
+  return gc->state == GC_IDLE ? !gc->black : gc->black;
+}
+
+void gcstats_print(const GCStats* stats, FILE* out);
+
+#endif
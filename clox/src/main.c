@@ -3,89 +3,218 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
+#include <unistd.h>
 
+#include "cache.h"
+#include "compiler.h"
+#include "source.h"
 #include "vm.h"
 
-static void repl(void) {
-  char line[1024];
+static void repl(VM* vm) {
+  Source line;
+  source_init(&line);
   for (;;) {
     printf("> ");
 
-    if (fgets(line, sizeof(line), stdin) == NULL) {
+    if (!source_read_line(&line, stdin)) {
       printf("\n");
       break;
     }
 
-    interpret(line);
+    interpret(vm, line.text);
   }
+  source_free(&line);
 }
 
-static char* read_file(const char* path) {
-  FILE* f = fopen(path, "rb");
-  if (f == NULL) {
-    fprintf(stderr, "error: could not open file \"%s\"\n", path);
-    exit(EX_NOINPUT);
+static void read_file(Source* source, const char* path) {
+  bool ok = (strcmp(path, "-") == 0) ? source_read_stream(source, stdin)
+                                      : source_open(source, path);
+  if (ok) {
+    return;
   }
 
-  int err = fseek(f, 0, SEEK_END);
-  if (err != 0) {
-    fprintf(stderr, "error: couldn't read file\"%s\"\n", path);
-    exit(EX_IOERR);
+  switch (errno) {
+    case ENOENT:
+    case EACCES:
+    case EISDIR:
+      fprintf(stderr, "error: could not open file \"%s\"\n", path);
+      exit(EX_NOINPUT);
+    case ENOMEM:
+      fprintf(stderr, "error: not enough memory to read file \"%s\"\n",
+              path);
+      exit(EX_OSERR);
+    default:
+      fprintf(stderr, "error: couldn't read file \"%s\"\n", path);
+      exit(EX_IOERR);
   }
+}
+
+static InterpretResult run_file(VM* vm, const char* path) {
+  Source source;
+  source_init(&source);
+  read_file(&source, path);
+  uint64_t hash = cache_hash_source(source.text, source.length);
 
-  long sz = ftell(f);
-  if (sz == 0 || sz == -1) {
-    fprintf(stderr, "error: couldn't read file\"%s\"\n", path);
-    exit(EX_NOINPUT);
+  // Skip the front end if an up-to-date bytecode cache exists. Scripts read
+  // from stdin have no cache.
+  InterpretResult result;
+  Chunk chunk;
+  chunk_init(&chunk, vm->allocator);
+  CacheMapping mapping;
+  char* loxc_path = (strcmp(path, "-") == 0) ? NULL : cache_path(path);
+  if (loxc_path != NULL && cache_load(vm, loxc_path, hash, &chunk, &mapping)) {
+    result = interpret_chunk(vm, &chunk);
+    cache_unload(&chunk, &mapping);
+  } else {
+    result = interpret(vm, source.text);
   }
+  free(loxc_path);
+  source_free(&source);
+  return result;
+}
 
-  rewind(f);
-  if (errno != 0) {
-    fprintf(stderr, "error: couldn't read file\"%s\"\n", path);
-    exit(EX_IOERR);
+static void compile_file(VM* vm, const char* path) {
+  Source source;
+  source_init(&source);
+  read_file(&source, path);
+  uint64_t hash = cache_hash_source(source.text, source.length);
+
+  Chunk chunk;
+  chunk_init(&chunk, vm->allocator);
+  if (!compile(vm, source.text, &chunk)) {
+    exit(EX_DATAERR);
   }
 
-  char* buf = malloc((size_t)sz + 1);
-  if (buf == NULL) {
-    fprintf(stderr, "error: not enough memory to read file\"%s\"\n", path);
+  char* loxc_path = cache_path(path);
+  if (loxc_path == NULL) {
+    fprintf(stderr, "error: not enough memory\n");
     exit(EX_OSERR);
   }
-
-  size_t count = fread(buf, sizeof(char), (size_t)sz, f);
-  if (count != (size_t)sz || (ferror(f) != 0 && feof(f) == 0)) {
-    fprintf(stderr, "error: couldn't read file\"%s\"\n", path);
-    exit(EX_IOERR);
+  if (!cache_write(vm, &chunk, hash, loxc_path)) {
+    fprintf(stderr, "error: couldn't write bytecode cache \"%s\"\n",
+            loxc_path);
+    exit(EX_CANTCREAT);
   }
-  buf[count] = '\0';
 
-  fclose(f);
-  return buf;
+  free(loxc_path);
+  chunk_free(&chunk);
+  source_free(&source);
 }
-static void run_file(const char* path) {
-  char* source = read_file(path);
-  InterpretResult result = interpret(source);
-  free(source);
 
-  if (result == INTERPRET_COMPILE_ERROR) {
-    exit(EX_DATAERR);
+static void print_stats(VM* vm, MemoryStats* memory) {
+  fflush(stdout);
+  fprintf(stderr, "compile time %10.3f ms\n", (double)vm->compile_time / 1e6);
+  fprintf(stderr, "run time     %10.3f ms\n", (double)vm->run_time / 1e6);
+  memorystats_print(memory, stderr);
+  gcstats_print(&vm->gc.stats, stderr);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: clox [--stats] [--gc-pause=us] [--profile[=folded]] "
+          "[path | -]\n"
+          "       clox --compile path\n");
+  exit(EX_USAGE);
+}
+
+// Prints the profile report, and writes folded stacks to `folded_path`
+// unless it is NULL
+static void print_profile(Profile* profile, const char* folded_path) {
+  fflush(stdout);
+  profile_report(profile, stderr);
+  if (folded_path == NULL) {
+    return;
   }
-  if (result == INTERPRET_RUNTIME_ERROR) {
-    exit(EX_SOFTWARE);
+
+  FILE* f = fopen(folded_path, "w");
+  if (f == NULL) {
+    fprintf(stderr, "error: couldn't write profile \"%s\"\n", folded_path);
+    exit(EX_CANTCREAT);
   }
+  profile_write_folded(profile, f);
+  fclose(f);
 }
 
 int main(int argc, const char* argv[]) {
-  vm_init();
+  MemoryStats stats;
+  Allocator allocator;
+  Allocator* vm_allocator = system_allocator();
+  bool print_stats_at_exit = false;
+  bool options = false;
+  uint64_t gc_pause = GC_PAUSE_DEFAULT;
+  Profile profile;
+  bool profiling = false;
+  const char* folded_path = NULL;
+  for (; argc > 1 && strncmp(argv[1], "--", 2) == 0 && argv[1][2] != '\0';
+       argc--, argv++) {
+    if (strcmp(argv[1], "--stats") == 0) {
+      memorystats_init(&stats);
+      system_allocator_init(&allocator, &stats);
+      vm_allocator = &allocator;
+      print_stats_at_exit = true;
+    } else if (strncmp(argv[1], "--gc-pause=", 11) == 0) {
+      char* end;
+      double microseconds = strtod(argv[1] + 11, &end);
+      if (end == argv[1] + 11 || *end != '\0' || !(microseconds >= 0)) {
+        usage();
+      }
+      gc_pause = (uint64_t)(microseconds * 1000);
+    } else if (strcmp(argv[1], "--profile") == 0) {
+      profiling = true;
+    } else if (strncmp(argv[1], "--profile=", 10) == 0) {
+      profiling = true;
+      folded_path = argv[1] + 10;
+    } else if (strcmp(argv[1], "--compile") == 0) {
+      break;
+    } else {
+      usage();
+    }
+    options = true;
+  }
+
+  VM vm;
+  vm_init(&vm, vm_allocator);
+  vm.gc.pause_target = gc_pause;
+  if (profiling) {
+    profile_init(&profile, vm.allocator);
+    if (!profile_start(&profile)) {
+      fprintf(stderr, "error: couldn't start the profiling timer\n");
+      exit(EX_OSERR);
+    }
+    vm.profile = &profile;
+  }
 
+  InterpretResult result = INTERPRET_OK;
   if (argc == 1) {
-    repl();
+    // Run piped scripts whole rather than line by line
+    if (isatty(STDIN_FILENO)) {
+      repl(&vm);
+    } else {
+      result = run_file(&vm, "-");
+    }
   } else if (argc == 2) {
-    run_file(argv[1]);
+    result = run_file(&vm, argv[1]);
+  } else if (argc == 3 && strcmp(argv[1], "--compile") == 0 && !options) {
+    compile_file(&vm, argv[2]);
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
-    exit(64);
+    usage();
+  }
+
+  if (profiling) {
+    profile_stop(&profile);
+    print_profile(&profile, folded_path);
+    profile_free(&profile);
+  }
+  if (print_stats_at_exit) {
+    print_stats(&vm, &stats);
   }
+  vm_free(&vm);
 
-  vm_free();
+  if (result == INTERPRET_COMPILE_ERROR) {
+    return EX_DATAERR;
+  }
+  if (result == INTERPRET_RUNTIME_ERROR) {
+    return EX_SOFTWARE;
+  }
   return 0;
 }
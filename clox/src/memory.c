@@ -1,16 +1,183 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "memory.h"
 
-void* reallocate(void* pointer, size_t new_size) {
+static void record(Allocator* allocator, MemoryCategory category,
+                   void* pointer, size_t old_size, size_t new_size) {
+  MemoryStats* stats = allocator->stats;
+  if (pointer == NULL) {
+    stats->allocations++;
+  } else if (new_size == 0) {
+    stats->frees++;
+  } else {
+    stats->reallocations++;
+  }
+
+  stats->bytes[category] += new_size - old_size;
+  if (stats->bytes[category] > stats->peak_bytes[category]) {
+    stats->peak_bytes[category] = stats->bytes[category];
+  }
+
+  if (!allocator->suballocator) {
+    stats->total_bytes += new_size - old_size;
+    if (stats->total_bytes > stats->peak_total_bytes) {
+      stats->peak_total_bytes = stats->total_bytes;
+    }
+  }
+}
+
+void* reallocate(Allocator* allocator, MemoryCategory category, void* pointer,
+                 size_t old_size, size_t new_size) {
+  void* result = allocator->reallocate(allocator, pointer, old_size, new_size);
+
+  // Failed allocations change nothing, and freeing NULL is a no-op
+  bool failed = result == NULL && new_size != 0;
+  bool noop = pointer == NULL && new_size == 0;
+  if (allocator->stats != NULL && !failed && !noop) {
+    record(allocator, category, pointer, old_size, new_size);
+  }
+  return result;
+}
+
+/* ---- System Allocator ---- */
+
+static void* system_reallocate(Allocator* self, void* pointer,
+                               size_t old_size, size_t new_size) {
+  (void)self;
+  (void)old_size;
+
   if (new_size == 0) {
     free(pointer);
     return NULL;
   }
 
-  void* result = realloc(pointer, new_size);
-  if (result == NULL) {
-    exit(1);
+  return realloc(pointer, new_size);
+}
+
+static Allocator system_instance = {.reallocate = system_reallocate};
+
+Allocator* system_allocator(void) { return &system_instance; }
+
+void system_allocator_init(Allocator* allocator, MemoryStats* stats) {
+  allocator->reallocate = system_reallocate;
+  allocator->stats = stats;
+  allocator->suballocator = false;
+}
+
+/* ---- Arena Allocator ---- */
+
+struct ArenaBlock {
+  ArenaBlock* next;
+  size_t size;
+  size_t used;
+  max_align_t data[];
+};
+
+#define ARENA_ALIGNMENT sizeof(max_align_t)
+#define ALIGN_UP(n) (((n) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+static uint8_t* block_data(ArenaBlock* block) { return (uint8_t*)block->data; }
+
+static void* arena_allocate(Arena* arena, size_t size) {
+  size = ALIGN_UP(size);
+
+  ArenaBlock* block = arena->blocks;
+  if (block == NULL || block->size - block->used < size) {
+    size_t data_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = reallocate(arena->parent, MEMORY_ARENA, NULL, 0,
+                       sizeof(ArenaBlock) + data_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->size = data_size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  uint8_t* result = block_data(block) + block->used;
+  block->used += size;
+  arena->last = result;
+  return result;
+}
+
+static void* arena_reallocate(Allocator* self, void* pointer, size_t old_size,
+                              size_t new_size) {
+  Arena* arena = (Arena*)self;
+  ArenaBlock* block = arena->blocks;
+
+  // The most recent allocation sits at the end of the current block, so it
+  // can be resized in place
+  if (pointer != NULL && pointer == arena->last) {
+    size_t start = (size_t)(arena->last - block_data(block));
+    size_t size = ALIGN_UP(new_size);
+    if (start + size <= block->size) {
+      block->used = start + size;
+      if (new_size == 0) {
+        arena->last = NULL;
+      }
+      return new_size == 0 ? NULL : pointer;
+    }
+  }
+
+  if (new_size == 0) {
+    return NULL;
+  }
+
+  void* result = arena_allocate(arena, new_size);
+  if (result != NULL && pointer != NULL) {
+    memcpy(result, pointer, old_size < new_size ? old_size : new_size);
   }
   return result;
 }
+
+void arena_init(Arena* arena, Allocator* parent) {
+  arena->allocator.reallocate = arena_reallocate;
+  arena->allocator.stats = parent->stats;
+  arena->allocator.suballocator = true;
+  arena->parent = parent;
+  arena->blocks = NULL;
+  arena->last = NULL;
+}
+
+void arena_free(Arena* arena) {
+  ArenaBlock* block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock* next = block->next;
+    reallocate(arena->parent, MEMORY_ARENA, block,
+               sizeof(ArenaBlock) + block->size, 0);
+    block = next;
+  }
+  arena_init(arena, arena->parent);
+}
+
+/* ---- Statistics ---- */
+
+static const char* category_names[] = {
+    [MEMORY_CODE] = "code",
+    [MEMORY_LINES] = "line tables",
+    [MEMORY_CONSTANTS] = "constants",
+    [MEMORY_STACK] = "stack",
+    [MEMORY_COMPILER] = "compiler",
+    [MEMORY_OBJECTS] = "objects",
+    [MEMORY_TABLES] = "tables",
+    [MEMORY_GLOBALS] = "globals",
+    [MEMORY_GC] = "gc worklist",
+    [MEMORY_PROFILE] = "profile",
+    [MEMORY_ARENA] = "arena blocks",
+};
+
+void memorystats_init(MemoryStats* stats) { *stats = (MemoryStats){0}; }
+
+void memorystats_print(const MemoryStats* stats, FILE* out) {
+  fprintf(out, "%-16s %12s %12s\n", "memory", "current", "peak");
+  for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    fprintf(out, "  %-14s %12zu %12zu\n", category_names[i], stats->bytes[i],
+            stats->peak_bytes[i]);
+  }
+  fprintf(out, "  %-14s %12zu %12zu\n", "total held", stats->total_bytes,
+          stats->peak_total_bytes);
+  fprintf(out, "%zu allocations, %zu reallocations, %zu frees\n",
+          stats->allocations, stats->reallocations, stats->frees);
+}
@@ -1,15 +1,92 @@
 #ifndef clox_memory_h
 #define clox_memory_h
 
+#include <stdio.h>
+
 #include "common.h"
 
+// What an allocation is for, so memory use can be broken down in reports
+typedef enum {
+  MEMORY_CODE,
+  MEMORY_LINES,
+  MEMORY_CONSTANTS,
+  MEMORY_STACK,
+  MEMORY_COMPILER,
+  MEMORY_OBJECTS,
+  MEMORY_TABLES,
+  MEMORY_GLOBALS,
+  MEMORY_GC,
+  MEMORY_PROFILE,
+  MEMORY_ARENA,
+  MEMORY_CATEGORY_COUNT,
+} MemoryCategory;
+
+// Byte-accurate accounting of everything allocated through reallocate().
+// Categories count the bytes that were asked for. The totals count memory
+// actually held from the system, so allocations carved out of an arena only
+// show up there as part of the arena's blocks.
+typedef struct {
+  size_t bytes[MEMORY_CATEGORY_COUNT];
+  size_t peak_bytes[MEMORY_CATEGORY_COUNT];
+  size_t total_bytes;
+  size_t peak_total_bytes;
+  size_t allocations;
+  size_t reallocations;
+  size_t frees;
+} MemoryStats;
+
+// Allocators implement a single realloc-style operation. A new_size of 0
+// frees the block, and a NULL result means the allocation failed.
+// Implementations embed an Allocator as their first member, so `self` can
+// be cast back to the implementation's own type.
+//
+// Allocations are recorded in `stats` unless it is NULL. Suballocators hand
+// out memory they got from another allocator, which has already counted it
+// towards the totals.
+typedef struct Allocator Allocator;
+struct Allocator {
+  void* (*reallocate)(Allocator* self, void* pointer, size_t old_size,
+                      size_t new_size);
+  MemoryStats* stats;
+  bool suballocator;
+};
+
+// Bump allocator for short-lived data. Frees are ignored, except for the
+// most recent allocation, and everything is released at once by
+// arena_free().
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+  Allocator allocator;
+  Allocator* parent;
+  ArenaBlock* blocks;
+  // Most recent allocation, which can still grow or shrink in place
+  uint8_t* last;
+} Arena;
+
+#define ARENA_BLOCK_SIZE 65536
+
 #define GROW_CAPACITY(capacity) ((capacity < 8) ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, pointer, old_count, new_count) \
-  (type*)reallocate(pointer, sizeof(type) * new_count)
+#define GROW_ARRAY(allocator, category, type, pointer, old_count, new_count) \
+  (type*)reallocate(allocator, category, pointer,                            \
+                    sizeof(type) * (old_count), sizeof(type) * (new_count))
+
+#define FREE_ARRAY(allocator, category, type, pointer, count)         \
+  reallocate(allocator, category, pointer, sizeof(type) * (count), 0)
+
+void* reallocate(Allocator* allocator, MemoryCategory category, void* pointer,
+                 size_t old_size, size_t new_size);
+
+// The shared system allocator keeps no statistics. Use system_allocator_init()
+// for one that does.
+Allocator* system_allocator(void);
+void system_allocator_init(Allocator* allocator, MemoryStats* stats);
 
-#define FREE_ARRAY(type, pointer, count) reallocate(pointer, 0)
+void memorystats_init(MemoryStats* stats);
+void memorystats_print(const MemoryStats* stats, FILE* out);
 
-void* reallocate(void* pointer, size_t new_size);
+void arena_init(Arena* arena, Allocator* parent);
+void arena_free(Arena* arena);
 
 #endif
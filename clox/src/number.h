@@ -0,0 +1,30 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+// Converts the text of a number literal, as the scanner finds it (digits,
+// optionally followed by '.' and more digits), to the nearest double. Only
+// the `length` characters at `start` are read, so the text doesn't need to
+// be terminated. Unlike strtod(), this doesn't depend on the locale.
+//
+// Integers up to 2^53 and short decimals are converted exactly with one
+// floating point operation at most. Everything else uses the Eisel-Lemire
+// algorithm, which is correctly rounded, and falls back to strtod() in the
+// rare cases it can't decide.
+double number_parse(const char* start, size_t length);
+
+// Enough for anything number_format() writes, and a terminator
+#define NUMBER_FORMAT_SIZE 32
+
+// Writes `number` to `out` exactly as printf's "%g" would in the C locale,
+// and returns the number of characters written. `out` needs room for
+// NUMBER_FORMAT_SIZE characters, and may not be terminated.
+//
+// Integers below a million are written directly. Other numbers are rounded
+// to six significant digits with one exact scaling, and only those too
+// close to halfway to round that way, or too large or small to scale
+// exactly, go through snprintf().
+size_t number_format(double number, char* out);
+
+#endif
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "gc.h"
+#include "memory.h"
+#include "object.h"
+#include "output.h"
+#include "table.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+// FNV-1a has no finalisation step, so the hash of a concatenation can be
+// computed by continuing from the hash of its first part
+static uint32_t hash_continue(uint32_t hash, const char* chars,
+                              size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)chars[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+// Allocates an uninterned string with room for `length` characters, which
+// the caller fills in
+static ObjString* allocate_string(VM* vm, size_t length, uint32_t hash) {
+  gc_allocating(vm);
+  ObjString* string = reallocate(vm->allocator, MEMORY_OBJECTS, NULL, 0,
+                                 sizeof(ObjString) + length + 1);
+  if (string == NULL) {
+    return NULL;
+  }
+
+  string->obj.type = OBJ_STRING;
+  string->obj.mark = gc_allocation_mark(&vm->gc);
+  string->obj.next = vm->objects;
+  vm->objects = &string->obj;
+  string->length = length;
+  string->hash = hash;
+  string->chars[length] = '\0';
+  return string;
+}
+
+// Adds a freshly built string to the intern table. On failure the string
+// stays on the object list, and is freed with the VM.
+static ObjString* intern(VM* vm, ObjString* string) {
+  if (!table_set(&vm->strings, string, NIL_VALUE())) {
+    return NULL;
+  }
+  return string;
+}
+
+ObjString* string_copy(VM* vm, const char* chars, size_t length) {
+  uint32_t hash = hash_continue(FNV_OFFSET_BASIS, chars, length);
+  ObjString* interned =
+      table_find_string(&vm->strings, chars, length, "", 0, hash);
+  if (interned != NULL) {
+    // The intern table is weak, so the collector may be about to free it
+    gc_weak_barrier(vm, &interned->obj);
+    return interned;
+  }
+
+  ObjString* string = allocate_string(vm, length, hash);
+  if (string == NULL) {
+    return NULL;
+  }
+  memcpy(string->chars, chars, length);
+  return intern(vm, string);
+}
+
+ObjString* string_concatenate(VM* vm, ObjString* a, ObjString* b) {
+  // The result is looked up before it is built, so concatenating into an
+  // existing string allocates nothing, and a new one is built in place
+  uint32_t hash = hash_continue(a->hash, b->chars, b->length);
+  ObjString* interned = table_find_string(&vm->strings, a->chars, a->length,
+                                          b->chars, b->length, hash);
+  if (interned != NULL) {
+    gc_weak_barrier(vm, &interned->obj);
+    return interned;
+  }
+
+  ObjString* string = allocate_string(vm, a->length + b->length, hash);
+  if (string == NULL) {
+    return NULL;
+  }
+  memcpy(string->chars, a->chars, a->length);
+  memcpy(string->chars + a->length, b->chars, b->length);
+  return intern(vm, string);
+}
+
+void object_write(Output* output, Value value) {
+  switch (OBJ_TYPE(value)) {
+    case OBJ_STRING: {
+      ObjString* string = AS_STRING(value);
+      output_write(output, string->chars, string->length);
+      break;
+    }
+  }
+}
+
+void object_print(Value value) {
+  switch (OBJ_TYPE(value)) {
+    case OBJ_STRING:
+      printf("%s", AS_CSTRING(value));
+      break;
+  }
+}
+
+void object_free(VM* vm, Obj* object) {
+  switch (object->type) {
+    case OBJ_STRING: {
+      ObjString* string = (ObjString*)object;
+      reallocate(vm->allocator, MEMORY_OBJECTS, object,
+                 sizeof(ObjString) + string->length + 1, 0);
+      break;
+    }
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef clox_object_h
+#define clox_object_h
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+
+#define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+
+#define AS_STRING(value) ((ObjString*)AS_OBJ(value))
+#define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
+
+typedef enum {
+  OBJ_STRING,
+} ObjType;
+
+// Every object is on its VM's list of objects, which the collector sweeps
+// and vm_free() walks to release them
+struct Obj {
+  ObjType type;
+  // See gc.h
+  bool mark;
+  struct Obj* next;
+};
+
+// Strings are immutable and interned, so two strings are equal exactly when
+// they are the same object. The characters are stored inline, with a
+// terminating NUL, in the same allocation as the header.
+struct ObjString {
+  Obj obj;
+  size_t length;
+  uint32_t hash;
+  char chars[];
+};
+
+// Both return NULL if memory runs out
+ObjString* string_copy(VM* vm, const char* chars, size_t length);
+ObjString* string_concatenate(VM* vm, ObjString* a, ObjString* b);
+
+void object_write(Output* output, Value value);
+void object_print(Value value);
+void object_free(VM* vm, Obj* object);
+
+static inline bool is_obj_type(Value value, ObjType type) {
+  return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#include "number.h"
+#include "output.h"
+
+void output_init(Output* output, FILE* stream) {
+  output->stream = stream;
+  output->length = 0;
+}
+
+void output_flush(Output* output) {
+  if (output->length > 0) {
+    fwrite(output->buffer, 1, output->length, output->stream);
+    output->length = 0;
+  }
+  fflush(output->stream);
+}
+
+void output_write_slow(Output* output, const char* text, size_t length) {
+  output_flush(output);
+  if (length >= OUTPUT_CAPACITY) {
+    // Too big to be worth copying
+    fwrite(text, 1, length, output->stream);
+    return;
+  }
+  memcpy(output->buffer, text, length);
+  output->length = length;
+}
+
+void output_number(Output* output, double number) {
+  if (OUTPUT_CAPACITY - output->length < NUMBER_FORMAT_SIZE) {
+    output_flush(output);
+  }
+  output->length += number_format(number, output->buffer + output->length);
+}
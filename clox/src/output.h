@@ -0,0 +1,45 @@
+#ifndef clox_output_h
+#define clox_output_h
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+
+#define OUTPUT_CAPACITY 8192
+
+// Collects what a script prints, so that printing a value costs a copy
+// rather than a trip through printf(). The buffer goes to the stream when
+// it fills up, and whenever it is flushed; the VM flushes it after running
+// each chunk and before reporting a runtime error.
+typedef struct Output {
+  FILE* stream;
+  size_t length;
+  char buffer[OUTPUT_CAPACITY];
+} Output;
+
+void output_init(Output* output, FILE* stream);
+// Writes out everything buffered, and flushes the stream as well
+void output_flush(Output* output);
+void output_write_slow(Output* output, const char* text, size_t length);
+// Formats `number` as printf's "%g" would
+void output_number(Output* output, double number);
+
+static inline void output_write(Output* output, const char* text,
+                                size_t length) {
+  if (length > OUTPUT_CAPACITY || output->length + length > OUTPUT_CAPACITY) {
+    output_write_slow(output, text, length);
+    return;
+  }
+  memcpy(output->buffer + output->length, text, length);
+  output->length += length;
+}
+
+static inline void output_char(Output* output, char c) {
+  if (output->length == OUTPUT_CAPACITY) {
+    output_flush(output);
+  }
+  output->buffer[output->length++] = c;
+}
+
+#endif
@@ -0,0 +1,356 @@
+#define _XOPEN_SOURCE 700
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+#include "profile.h"
+
+// Number of lines, and of each length of opcode sequence, that
+// profile_report() lists
+#define PROFILE_TOP_LINES 20
+#define PROFILE_TOP_SEQUENCES 10
+
+// Counters in Profile.triples
+#define TRIPLE_COUNT ((size_t)OPCODE_COUNT * OPCODE_COUNT * OPCODE_COUNT)
+
+struct ProfileTimer {
+  timer_t id;
+};
+
+static void handle_tick(int signal, siginfo_t* info, void* context) {
+  (void)signal;
+  (void)context;
+  // Each timer carries its own profile
+  if (info->si_code == SI_TIMER) {
+    Profile* profile = info->si_value.sival_ptr;
+    atomic_fetch_add_explicit(&profile->ticks, 1, memory_order_relaxed);
+  }
+}
+
+void profile_init(Profile* profile, Allocator* allocator) {
+  *profile = (Profile){.allocator = allocator};
+  profile->previous[0] = OPCODE_COUNT;
+  profile->previous[1] = OPCODE_COUNT;
+}
+
+void profile_free(Profile* profile) {
+  profile_stop(profile);
+  FREE_ARRAY(profile->allocator, MEMORY_PROFILE, Sample, profile->samples,
+             profile->sample_capacity);
+  FREE_ARRAY(profile->allocator, MEMORY_PROFILE, uint64_t, profile->triples,
+             profile->triples != NULL ? TRIPLE_COUNT : 0);
+  profile_init(profile, profile->allocator);
+}
+
+bool profile_start(Profile* profile) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = handle_tick;
+  action.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, NULL) == -1) {
+    return false;
+  }
+
+  ProfileTimer* timer = reallocate(profile->allocator, MEMORY_PROFILE, NULL,
+                                   0, sizeof(ProfileTimer));
+  if (timer == NULL) {
+    return false;
+  }
+  struct sigevent event;
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_SIGNAL;
+  event.sigev_signo = SIGPROF;
+  event.sigev_value.sival_ptr = profile;
+  struct itimerspec interval = {
+      .it_interval = {.tv_sec = 0, .tv_nsec = PROFILE_INTERVAL * 1000},
+      .it_value = {.tv_sec = 0, .tv_nsec = PROFILE_INTERVAL * 1000},
+  };
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer->id) == -1) {
+    reallocate(profile->allocator, MEMORY_PROFILE, timer,
+               sizeof(ProfileTimer), 0);
+    return false;
+  }
+  if (timer_settime(timer->id, 0, &interval, NULL) == -1) {
+    timer_delete(timer->id);
+    reallocate(profile->allocator, MEMORY_PROFILE, timer,
+               sizeof(ProfileTimer), 0);
+    return false;
+  }
+  profile->timer = timer;
+  return true;
+}
+
+void profile_stop(Profile* profile) {
+  if (profile->timer != NULL) {
+    // Deleting the timer also discards a signal it has pending
+    timer_delete(profile->timer->id);
+    reallocate(profile->allocator, MEMORY_PROFILE, profile->timer,
+               sizeof(ProfileTimer), 0);
+    profile->timer = NULL;
+  }
+  profile_outside(profile);
+}
+
+/* ---- Sampling ---- */
+
+void profile_sample(Profile* profile, Chunk* chunk, const uint8_t* ip) {
+  uint64_t ticks =
+      atomic_exchange_explicit(&profile->ticks, 0, memory_order_relaxed);
+
+  // Consecutive samples often hit the same instruction
+  size_t line = chunk_get_line(chunk, (size_t)(ip - chunk->code));
+  Sample* last = profile->sample_count > 0
+                     ? &profile->samples[profile->sample_count - 1]
+                     : NULL;
+  if (last != NULL && last->line == line && last->opcode == *ip) {
+    last->count += ticks;
+    return;
+  }
+
+  if (profile->sample_capacity < profile->sample_count + 1) {
+    size_t capacity = GROW_CAPACITY(profile->sample_capacity);
+    Sample* samples =
+        GROW_ARRAY(profile->allocator, MEMORY_PROFILE, Sample,
+                   profile->samples, profile->sample_capacity, capacity);
+    if (samples == NULL) {
+      profile->dropped += ticks;
+      return;
+    }
+    profile->samples = samples;
+    profile->sample_capacity = capacity;
+  }
+  profile->samples[profile->sample_count++] =
+      (Sample){.line = line, .opcode = *ip, .count = ticks};
+}
+
+void profile_outside(Profile* profile) {
+  profile->outside +=
+      atomic_exchange_explicit(&profile->ticks, 0, memory_order_relaxed);
+  profile->running = NULL;
+  // Sequences don't carry over from one run() to the next
+  profile->previous[0] = OPCODE_COUNT;
+  profile->previous[1] = OPCODE_COUNT;
+}
+
+/* ---- Sequences ---- */
+
+void profile_sequence(Profile* profile, uint8_t opcode) {
+  uint8_t last = profile->previous[0];
+  uint8_t before = profile->previous[1];
+  profile->previous[1] = last;
+  profile->previous[0] = opcode;
+  if (last == OPCODE_COUNT) {
+    return;
+  }
+  profile->pairs[last][opcode]++;
+  if (before == OPCODE_COUNT) {
+    return;
+  }
+
+  if (profile->triples == NULL) {
+    profile->triples = GROW_ARRAY(profile->allocator, MEMORY_PROFILE,
+                                  uint64_t, NULL, 0, TRIPLE_COUNT);
+    if (profile->triples == NULL) {
+      return;
+    }
+    memset(profile->triples, 0, TRIPLE_COUNT * sizeof(uint64_t));
+  }
+  profile->triples[opcode_sequence(before, last, opcode)]++;
+}
+
+/* ---- Reports ---- */
+
+static int compare_samples(const void* a, const void* b) {
+  const Sample* x = a;
+  const Sample* y = b;
+  if (x->line != y->line) {
+    return x->line < y->line ? -1 : 1;
+  }
+  return (int)x->opcode - (int)y->opcode;
+}
+
+// Sorts the samples by line and opcode, and merges duplicates
+static void merge_samples(Profile* profile) {
+  if (profile->sample_count == 0) {
+    return;
+  }
+  qsort(profile->samples, profile->sample_count, sizeof(Sample),
+        compare_samples);
+
+  size_t merged = 0;
+  for (size_t i = 1; i < profile->sample_count; i++) {
+    Sample* sample = &profile->samples[i];
+    Sample* last = &profile->samples[merged];
+    if (sample->line == last->line && sample->opcode == last->opcode) {
+      last->count += sample->count;
+    } else {
+      profile->samples[++merged] = *sample;
+    }
+  }
+  profile->sample_count = merged + 1;
+}
+
+typedef struct {
+  size_t line;
+  uint64_t count;
+} LineTotal;
+
+static int compare_line_totals(const void* a, const void* b) {
+  const LineTotal* x = a;
+  const LineTotal* y = b;
+  if (x->count != y->count) {
+    return x->count > y->count ? -1 : 1;
+  }
+  return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole == 0 ? 0 : 100.0 * (double)part / (double)whole;
+}
+
+static uint64_t total_instructions(Profile* profile) {
+  uint64_t total = 0;
+  for (int i = 0; i < OPCODE_COUNT; i++) {
+    total += profile->instructions[i];
+  }
+  return total;
+}
+
+static void report_opcodes(Profile* profile, FILE* out) {
+  uint64_t total = total_instructions(profile);
+  fprintf(out, "%-22s %14s %8s\n", "opcode", "executed", "%");
+
+  // Busiest first, by selection; there are few opcodes
+  bool shown[OPCODE_COUNT] = {false};
+  for (int n = 0; n < OPCODE_COUNT; n++) {
+    int best = -1;
+    for (int i = 0; i < OPCODE_COUNT; i++) {
+      if (!shown[i] && profile->instructions[i] > 0 &&
+          (best == -1 ||
+           profile->instructions[i] > profile->instructions[best])) {
+        best = i;
+      }
+    }
+    if (best == -1) {
+      break;
+    }
+    shown[best] = true;
+    fprintf(out, "  %-20s %14" PRIu64 " %7.2f%%\n",
+            opcode_name((uint8_t)best), profile->instructions[best],
+            percent(profile->instructions[best], total));
+  }
+  fprintf(out, "  %-20s %14" PRIu64 "\n", "total", total);
+}
+
+// Lists the PROFILE_TOP_SEQUENCES largest of `count` counters, each of
+// which counts a sequence of `length` opcodes, indexed like
+// opcode_sequence()
+static void report_sequences(const uint64_t* counters, size_t count,
+                             int length, uint64_t total, FILE* out) {
+  fprintf(out, "%-50s %14s %8s\n", length == 2 ? "pair" : "triple",
+          "executed", "%");
+  uint64_t limit = UINT64_MAX;
+  size_t after = 0;
+  for (int n = 0; n < PROFILE_TOP_SEQUENCES; n++) {
+    // The largest counter below the last one listed, or equal to it and
+    // further along; ties are listed in index order
+    size_t best = SIZE_MAX;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t c = counters[i];
+      bool listable = c < limit || (c == limit && i > after);
+      if (c > 0 && listable && (best == SIZE_MAX || c > counters[best])) {
+        best = i;
+      }
+    }
+    if (best == SIZE_MAX) {
+      break;
+    }
+    limit = counters[best];
+    after = best;
+
+    const char* names[3];
+    size_t index = best;
+    for (int i = length - 1; i >= 0; i--) {
+      names[i] = opcode_name((uint8_t)(index % OPCODE_COUNT));
+      index /= OPCODE_COUNT;
+    }
+    char sequence[64];
+    if (length == 2) {
+      snprintf(sequence, sizeof(sequence), "%s %s", names[0], names[1]);
+    } else {
+      snprintf(sequence, sizeof(sequence), "%s %s %s", names[0], names[1],
+               names[2]);
+    }
+    fprintf(out, "  %-48s %14" PRIu64 " %7.2f%%\n", sequence, limit,
+            percent(limit, total));
+  }
+}
+
+static void report_lines(Profile* profile, uint64_t sampled, FILE* out) {
+  // Samples are sorted by line, so each line's are adjacent
+  LineTotal* lines = GROW_ARRAY(profile->allocator, MEMORY_PROFILE,
+                                LineTotal, NULL, 0, profile->sample_count);
+  if (lines == NULL && profile->sample_count > 0) {
+    return;
+  }
+  size_t line_count = 0;
+  for (size_t i = 0; i < profile->sample_count; i++) {
+    Sample* sample = &profile->samples[i];
+    if (line_count > 0 && lines[line_count - 1].line == sample->line) {
+      lines[line_count - 1].count += sample->count;
+    } else {
+      lines[line_count++] =
+          (LineTotal){.line = sample->line, .count = sample->count};
+    }
+  }
+  qsort(lines, line_count, sizeof(LineTotal), compare_line_totals);
+
+  fprintf(out, "%-18s %14s %8s\n", "line", "samples", "%");
+  for (size_t i = 0; i < line_count && i < PROFILE_TOP_LINES; i++) {
+    fprintf(out, "  %-16zu %14" PRIu64 " %7.2f%%\n", lines[i].line,
+            lines[i].count, percent(lines[i].count, sampled));
+  }
+  if (line_count > PROFILE_TOP_LINES) {
+    fprintf(out, "  (%zu more lines)\n", line_count - PROFILE_TOP_LINES);
+  }
+  FREE_ARRAY(profile->allocator, MEMORY_PROFILE, LineTotal, lines,
+             profile->sample_count);
+}
+
+void profile_report(Profile* profile, FILE* out) {
+  merge_samples(profile);
+  uint64_t sampled = 0;
+  for (size_t i = 0; i < profile->sample_count; i++) {
+    sampled += profile->samples[i].count;
+  }
+
+  fprintf(out,
+          "profile: %" PRIu64 " samples every %d us, %" PRIu64
+          " outside the interpreter, %" PRIu64 " dropped\n",
+          sampled, PROFILE_INTERVAL, profile->outside, profile->dropped);
+  report_opcodes(profile, out);
+  uint64_t total = total_instructions(profile);
+  report_sequences(&profile->pairs[0][0], OPCODE_COUNT * OPCODE_COUNT, 2,
+                   total, out);
+  if (profile->triples != NULL) {
+    report_sequences(profile->triples, TRIPLE_COUNT, 3, total, out);
+  }
+  report_lines(profile, sampled, out);
+}
+
+void profile_write_folded(Profile* profile, FILE* out) {
+  merge_samples(profile);
+  for (size_t i = 0; i < profile->sample_count; i++) {
+    Sample* sample = &profile->samples[i];
+    fprintf(out, "script;line %zu;%s %" PRIu64 "\n", sample->line,
+            opcode_name(sample->opcode), sample->count);
+  }
+  if (profile->outside > 0) {
+    fprintf(out, "outside %" PRIu64 "\n", profile->outside);
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "memory.h"
+
+// Sampling profiler. While a profile is attached to a VM, run() counts
+// every instruction it executes, by opcode. Each running profile has its own
+// timer, which raises SIGPROF every PROFILE_INTERVAL microseconds of CPU
+// time used by the thread that started it. The signal handler only counts
+// the tick on the timer's profile; when the instruction that was running
+// finishes, run() charges the sample to that instruction's source line and
+// opcode. VMs on different threads can be profiled at the same time.
+//
+// It also counts the sequences of two and three opcodes that run one after
+// the other, which is what superinstructions are chosen from.
+#define PROFILE_INTERVAL 1000
+
+// Samples charged to one instruction, possibly merged with others on the
+// same line with the same opcode
+typedef struct {
+  size_t line;
+  uint8_t opcode;
+  uint64_t count;
+} Sample;
+
+typedef struct ProfileTimer ProfileTimer;
+
+typedef struct {
+  // Holds the samples and sequence counters
+  Allocator* allocator;
+  // Set while the profile is running
+  ProfileTimer* timer;
+  uint64_t instructions[OPCODE_COUNT];
+  // The opcodes of the last two instructions in this run(), the latest
+  // first, or OPCODE_COUNT if there weren't that many
+  uint8_t previous[2];
+  uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT];
+  // OPCODE_COUNT^3 counters, indexed by opcode_sequence(), allocated when
+  // the first triple runs. NULL if that failed.
+  uint64_t* triples;
+  // Ticks not yet charged to an instruction. The signal may be handled on
+  // any thread.
+  atomic_uint ticks;
+  // The instruction run() is executing, or NULL outside run()
+  const uint8_t* running;
+  // Ticks that arrived outside run(), such as while compiling
+  uint64_t outside;
+  size_t sample_count;
+  size_t sample_capacity;
+  Sample* samples;
+  // Ticks lost because the sample array couldn't grow
+  uint64_t dropped;
+} Profile;
+
+// `allocator` must outlive the profile. clox uses the VM's, so the profile
+// shows up in --stats.
+void profile_init(Profile* profile, Allocator* allocator);
+void profile_free(Profile* profile);
+// Starts and stops the timer. profile_start() returns false if it can't be
+// set up.
+bool profile_start(Profile* profile);
+void profile_stop(Profile* profile);
+
+void profile_sample(Profile* profile, Chunk* chunk, const uint8_t* ip);
+void profile_sequence(Profile* profile, uint8_t opcode);
+// Charges pending ticks to code outside run(). Called as run() starts.
+void profile_outside(Profile* profile);
+
+// Called by run() before each instruction
+static inline void profile_instruction(Profile* profile, Chunk* chunk,
+                                       const uint8_t* ip) {
+  if (atomic_load_explicit(&profile->ticks, memory_order_relaxed) != 0 &&
+      profile->running != NULL) {
+    profile_sample(profile, chunk, profile->running);
+  }
+  profile->running = ip;
+  profile->instructions[*ip]++;
+  profile_sequence(profile, *ip);
+}
+
+static inline size_t opcode_sequence(uint8_t first, uint8_t second,
+                                     uint8_t third) {
+  return ((size_t)first * OPCODE_COUNT + second) * OPCODE_COUNT + third;
+}
+
+// Human-readable summary: instructions by opcode, the commonest sequences
+// of opcodes, and the hottest lines
+void profile_report(Profile* profile, FILE* out);
+// One "script;line N;OPCODE count" line per line and opcode, for flame
+// graph tools
+void profile_write_folded(Profile* profile, FILE* out);
+
+#endif
@@ -1,195 +1,446 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-  const char* start;
-  const char* current;
-  int line;
-} Scanner;
+#ifdef SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+void scanner_init(Scanner* scanner, const char* source) {
+  scanner->start = source;
+  scanner->current = source;
+  scanner->line = 1;
+}
+
+/* ---- Character Classes ---- */
+
+// What a character can start. scan_token() switches on the class of a
+// token's first character, which compiles to a single jump through a table
+// instead of a chain of comparisons.
+typedef enum {
+  CHAR_OTHER,    // Not valid outside strings and comments
+  CHAR_END,      // The '\0' terminator
+  CHAR_BLANK,    // ' ', '\t' and '\r'
+  CHAR_NEWLINE,  // '\n'
+  CHAR_SLASH,    // '/', a token or a comment
+  CHAR_QUOTE,    // '"'
+  CHAR_DIGIT,    // '0' to '9'
+  CHAR_ALPHA,    // Letters and '_'
+  CHAR_SINGLE,   // Always a token by itself
+  CHAR_PAIR,     // '!', '=', '<' and '>', which may be followed by '='
+} CharClass;
+
+#define O CHAR_OTHER
+#define E CHAR_END
+#define B CHAR_BLANK
+#define N CHAR_NEWLINE
+#define C CHAR_SLASH
+#define Q CHAR_QUOTE
+#define D CHAR_DIGIT
+#define A CHAR_ALPHA
+#define S CHAR_SINGLE
+#define P CHAR_PAIR
 
-Scanner scanner;
+static const uint8_t char_classes[256] = {
+    E, O, O, O, O, O, O, O, O, B, N, O, O, B, O, O,  // 0x00
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,  // 0x10
+    B, P, Q, O, O, O, O, O, S, S, S, S, S, S, S, C,  // 0x20
+    D, D, D, D, D, D, D, D, D, D, O, S, P, P, P, O,  // 0x30
+    O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,  // 0x40
+    A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, A,  // 0x50
+    O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,  // 0x60
+    A, A, A, A, A, A, A, A, A, A, A, S, O, S, O, O,  // 0x70
+    // Bytes from 0x80 up are all CHAR_OTHER
+};
 
-void scanner_init(const char* source) {
-  scanner.start = source;
-  scanner.current = source;
-  scanner.line = 1;
+#undef O
+#undef E
+#undef B
+#undef N
+#undef C
+#undef Q
+#undef D
+#undef A
+#undef S
+#undef P
+
+// The token for each CHAR_SINGLE and CHAR_PAIR character. A pair's token
+// with '=' is the one after it in TokenType.
+static const uint8_t char_tokens[256] = {
+    ['('] = TOKEN_LEFT_PAREN, [')'] = TOKEN_RIGHT_PAREN,
+    ['{'] = TOKEN_LEFT_BRACE, ['}'] = TOKEN_RIGHT_BRACE,
+    [','] = TOKEN_COMMA,      ['.'] = TOKEN_DOT,
+    ['-'] = TOKEN_MINUS,      ['+'] = TOKEN_PLUS,
+    [';'] = TOKEN_SEMICOLON,  ['/'] = TOKEN_SLASH,
+    ['*'] = TOKEN_STAR,       ['!'] = TOKEN_BANG,
+    ['='] = TOKEN_EQUAL,      ['<'] = TOKEN_LESS,
+    ['>'] = TOKEN_GREATER,
+};
+
+static CharClass char_class(char c) {
+  return (CharClass)char_classes[(uint8_t)c];
 }
 
-inline static bool is_digit(char c) { return (c >= '0' && c <= '9'); }
-inline static bool is_alpha(char c) {
-  return ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c == '_'));
+static bool is_digit(char c) { return char_class(c) == CHAR_DIGIT; }
+
+// CHAR_DIGIT and CHAR_ALPHA are adjacent, so this is one comparison
+static bool is_identifier(char c) {
+  return (unsigned)(char_class(c) - CHAR_DIGIT) <= CHAR_ALPHA - CHAR_DIGIT;
 }
 
-inline static bool is_eof(void) { return (*scanner.current == '\0'); }
+/* ---- Cursor ---- */
 
-inline static char peek(void) { return *scanner.current; }
+inline static bool is_eof(Scanner* scanner) {
+  return (*scanner->current == '\0');
+}
+
+inline static char peek(Scanner* scanner) { return *scanner->current; }
 
-static char peek_next(void) {
-  if (is_eof()) {
+static char peek_next(Scanner* scanner) {
+  if (is_eof(scanner)) {
     return '\0';
   }
-  return *(scanner.current + 1);
+  return *(scanner->current + 1);
 }
 
-static char advance(void) { return *(scanner.current++); }
+static char advance(Scanner* scanner) { return *(scanner->current++); }
 
-static bool match(char expected) {
-  if (is_eof()) {
+static bool match(Scanner* scanner, char expected) {
+  if (is_eof(scanner)) {
     return false;
   }
-  if (*scanner.current != expected) {
+  if (*scanner->current != expected) {
     return false;
   }
-  scanner.current++;
+  scanner->current++;
   return true;
 }
 
-inline static Token make_token(TokenType type) {
+inline static Token make_token(Scanner* scanner, TokenType type) {
   return (Token){
       .type = type,
-      .start = scanner.start,
-      .length = (long)(scanner.current - scanner.start),
-      .line = scanner.line,
+      .start = scanner->start,
+      .length = (long)(scanner->current - scanner->start),
+      .line = scanner->line,
   };
 }
 
-inline static Token make_error(const char* msg) {
+inline static Token make_error(Scanner* scanner, const char* msg) {
   return (Token){
       .type = TOKEN_ERROR,
       .start = msg,
       .length = (long)strlen(msg),
-      .line = scanner.line,
+      .line = scanner->line,
   };
 }
 
-static Token scan_string(void) {
-  while (peek() != '"' && !is_eof()) {
-    if (peek() == '\n') {
-      scanner.line++;
-    }
-    advance();
+/* ---- Runs ---- */
+
+// Each function skips a run of characters starting at `p` and returns the
+// first character after it. The '\0' terminator always ends a run. Those
+// that can cross newlines add them to `*line`.
+
+#ifdef SIMD_SSE2
+
+// The source is read in aligned 16-byte blocks. A block never straddles a
+// page, so the block holding the terminator can be read in full even
+// though its tail is past the end of the source. AddressSanitizer can't
+// know that, so it is kept out of these functions.
+#if defined(__SANITIZE_ADDRESS__)
+#define ADDRESS_SANITIZER
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define ADDRESS_SANITIZER
+#endif
+#endif
+#ifdef ADDRESS_SANITIZER
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define NO_SANITIZE_ADDRESS
+#endif
+
+// The block loops are kept out of scan_token(), where they would crowd the
+// common short paths
+#ifdef __GNUC__
+#define NO_INLINE __attribute__((noinline))
+#else
+#define NO_INLINE
+#endif
+
+#define BLOCK_SIZE 16
+// Bytes looked at one by one before switching to blocks, for short runs
+#define SCALAR_PREFIX 8
+
+static int ctz(uint32_t mask) {
+#ifdef __GNUC__
+  return __builtin_ctz(mask);
+#else
+  int bit = 0;
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    bit++;
   }
+  return bit;
+#endif
+}
 
-  if (is_eof()) {
-    return make_error("unterminated string");
+// Newlines are sparse, so clearing bits one at a time beats a call to
+// libgcc's popcount (there is no popcount instruction in baseline x86-64)
+static int popcount(uint32_t mask) {
+  int count = 0;
+  for (; mask != 0; mask &= mask - 1) {
+    count++;
   }
+  return count;
+}
 
-  // The closing quote
-  advance();
-  return make_token(TOKEN_STRING);
+static const char* block_of(const char* p) {
+  return (const char*)((uintptr_t)p & ~(uintptr_t)(BLOCK_SIZE - 1));
 }
 
-static Token scan_number(void) {
-  while (is_digit(peek())) {
-    advance();
+// One bit per byte of the block, for the bytes at or after `p`
+static uint32_t bytes_from(const char* block, const char* p) {
+  return (0xffffu << (p - block)) & 0xffffu;
+}
+
+static uint32_t match_byte(__m128i bytes, char c) {
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+}
+
+// Bytes between `low` and `high` inclusive. Adding 0x80 - low moves the
+// range to the bottom of the signed bytes, where one comparison finds it.
+static uint32_t match_range(__m128i bytes, char low, char high) {
+  __m128i shifted = _mm_add_epi8(bytes, _mm_set1_epi8((char)(0x80 - low)));
+  __m128i limit = _mm_set1_epi8((char)(0x80 + (high - low) + 1));
+  return (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(shifted, limit));
+}
+
+// Finds the first byte from `p` that is in `stop`, counting the '\n' bytes
+// before it. Written as a macro so each caller's masks are inlined.
+#define SCAN_BLOCKS(p, line, stop, newlines)                   \
+  do {                                                         \
+    const char* block = block_of(p);                           \
+    uint32_t from = bytes_from(block, p);                      \
+    for (;; block += BLOCK_SIZE, from = 0xffffu) {             \
+      __m128i bytes = _mm_load_si128((const __m128i*)block);   \
+      uint32_t found = (stop) & from;                          \
+      uint32_t counted = (newlines) & from;                    \
+      if (found != 0) {                                        \
+        int end = ctz(found);                                  \
+        *(line) += popcount(counted & ((1u << end) - 1));      \
+        return block + end;                                    \
+      }                                                        \
+      *(line) += popcount(counted);                            \
+    }                                                          \
+  } while (false)
+
+NO_SANITIZE_ADDRESS NO_INLINE
+static const char* blanks_from(const char* p, int* line) {
+  SCAN_BLOCKS(p, line,
+              ~(match_byte(bytes, ' ') | match_byte(bytes, '\t') |
+                match_byte(bytes, '\r') | match_byte(bytes, '\n')),
+              match_byte(bytes, '\n'));
+}
+
+NO_SANITIZE_ADDRESS NO_INLINE
+static const char* identifier_from(const char* p) {
+  int lines = 0;
+  // Setting bit 5 folds upper case letters onto lower case ones
+  SCAN_BLOCKS(p, &lines,
+              ~(match_range(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a',
+                            'z') |
+                match_range(bytes, '0', '9') | match_byte(bytes, '_')),
+              0);
+}
+
+// Most runs of blanks are a space or two between tokens, and most
+// identifiers are short. Those are quicker to see byte by byte, so blocks
+// are only used once a run is longer than SCALAR_PREFIX.
+static const char* skip_blanks(const char* p, int* line) {
+  for (const char* prefix = p + SCALAR_PREFIX; p < prefix; p++) {
+    if (*p == '\n') {
+      (*line)++;
+    } else if (*p != ' ' && *p != '\t' && *p != '\r') {
+      return p;
+    }
   }
+  return blanks_from(p, line);
+}
 
-  // Look for a fractional part
-  if (peek() == '.' && is_digit(peek_next())) {
-    // Consume the dot
-    advance();
+static const char* skip_identifier(const char* p) {
+  for (const char* prefix = p + SCALAR_PREFIX; p < prefix; p++) {
+    if (!is_identifier(*p)) {
+      return p;
+    }
+  }
+  return identifier_from(p);
+}
 
-    while (is_digit(peek())) {
-      advance();
+NO_SANITIZE_ADDRESS NO_INLINE
+static const char* skip_comment(const char* p) {
+  int lines = 0;
+  SCAN_BLOCKS(p, &lines, match_byte(bytes, '\n') | match_byte(bytes, '\0'),
+              0);
+}
+
+NO_SANITIZE_ADDRESS NO_INLINE
+static const char* skip_string(const char* p, int* line) {
+  SCAN_BLOCKS(p, line, match_byte(bytes, '"') | match_byte(bytes, '\0'),
+              match_byte(bytes, '\n'));
+}
+
+#else
+
+static const char* skip_blanks(const char* p, int* line) {
+  for (;; p++) {
+    switch (*p) {
+      case '\n':
+        (*line)++;
+        break;
+      case ' ':
+      case '\t':
+      case '\r':
+        break;
+      default:
+        return p;
     }
   }
+}
 
-  return make_token(TOKEN_NUMBER);
+static const char* skip_comment(const char* p) {
+  return p + strcspn(p, "\n");
 }
 
-static TokenType check_keyword(size_t start, size_t length, const char* rest,
-                               TokenType type) {
-  if ((((size_t)(scanner.current - scanner.start)) == (start + length)) &&
-      (memcmp(scanner.start + start, rest, length) == 0)) {
-    return type;
+static const char* skip_string(const char* p, int* line) {
+  for (p += strcspn(p, "\"\n"); *p == '\n'; p += strcspn(p, "\"\n")) {
+    (*line)++;
+    p++;
   }
-  return TOKEN_IDENTIFIER;
+  return p;
 }
 
-static TokenType identifier_type(void) {
-  switch (scanner.start[0]) {
-    case 'a':
-      return check_keyword(1, 2, "nd", TOKEN_AND);
-    case 'c':
-      return check_keyword(1, 4, "lass", TOKEN_CLASS);
-    case 'e':
-      return check_keyword(1, 3, "lse", TOKEN_ELSE);
-    case 'f':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'a':
-            return check_keyword(2, 3, "lse", TOKEN_FALSE);
-          case 'o':
-            return check_keyword(2, 1, "r", TOKEN_FOR);
-          case 'u':
-            return check_keyword(2, 1, "n", TOKEN_FUN);
-        }
-      }
-      break;
-    case 'i':
-      return check_keyword(1, 1, "f", TOKEN_IF);
-    case 'n':
-      return check_keyword(1, 2, "il", TOKEN_NIL);
-    case 'o':
-      return check_keyword(1, 1, "r", TOKEN_OR);
-    case 'p':
-      return check_keyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r':
-      return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's':
-      return check_keyword(1, 4, "uper", TOKEN_SUPER);
-    case 't':
-      if (scanner.current - scanner.start > 1) {
-        switch (scanner.start[1]) {
-          case 'h':
-            return check_keyword(2, 2, "is", TOKEN_THIS);
-          case 'r':
-            return check_keyword(2, 2, "ue", TOKEN_TRUE);
-        }
-      }
-      break;
-    case 'v':
-      return check_keyword(1, 2, "ar", TOKEN_VAR);
-    case 'w':
-      return check_keyword(1, 4, "hile", TOKEN_WHILE);
+static const char* skip_identifier(const char* p) {
+  while (is_identifier(*p)) {
+    p++;
+  }
+  return p;
+}
+
+#endif
+
+/* ---- Keywords ---- */
+
+// Keywords are found with a perfect hash of an identifier's first and last
+// characters and its length. KEYWORD() places each keyword at its hash, so
+// two keywords sharing a slot fail the build with -Woverride-init. The
+// multiplier was picked by trying small ones until there were no
+// collisions.
+#define KEYWORD_SLOTS 32
+#define KEYWORD_HASH(first, last, length) \
+  (((unsigned)(first) + 5u * (unsigned)(last) + (unsigned)(length)) & \
+   (KEYWORD_SLOTS - 1))
+
+typedef struct {
+  const char* name;
+  uint8_t length;
+  uint8_t type;
+} Keyword;
+
+#define KEYWORD(name, first, last, type)                    \
+  [KEYWORD_HASH(first, last, sizeof(name) - 1)] = {name,   \
+                                                   sizeof(name) - 1, type}
+
+static const Keyword keywords[KEYWORD_SLOTS] = {
+    KEYWORD("and", 'a', 'd', TOKEN_AND),
+    KEYWORD("class", 'c', 's', TOKEN_CLASS),
+    KEYWORD("else", 'e', 'e', TOKEN_ELSE),
+    KEYWORD("false", 'f', 'e', TOKEN_FALSE),
+    KEYWORD("for", 'f', 'r', TOKEN_FOR),
+    KEYWORD("fun", 'f', 'n', TOKEN_FUN),
+    KEYWORD("if", 'i', 'f', TOKEN_IF),
+    KEYWORD("nil", 'n', 'l', TOKEN_NIL),
+    KEYWORD("or", 'o', 'r', TOKEN_OR),
+    KEYWORD("print", 'p', 't', TOKEN_PRINT),
+    KEYWORD("return", 'r', 'n', TOKEN_RETURN),
+    KEYWORD("super", 's', 'r', TOKEN_SUPER),
+    KEYWORD("this", 't', 's', TOKEN_THIS),
+    KEYWORD("true", 't', 'e', TOKEN_TRUE),
+    KEYWORD("var", 'v', 'r', TOKEN_VAR),
+    KEYWORD("while", 'w', 'e', TOKEN_WHILE),
+};
+
+#undef KEYWORD
+
+static TokenType identifier_type(const char* start, size_t length) {
+  const Keyword* keyword = &keywords[KEYWORD_HASH(
+      (uint8_t)start[0], (uint8_t)start[length - 1], length)];
+  if (keyword->length != length) {
+    return TOKEN_IDENTIFIER;
+  }
+  // Keywords are too short for a call to memcmp() to pay off
+  for (size_t i = 0; i < length; i++) {
+    if (start[i] != keyword->name[i]) {
+      return TOKEN_IDENTIFIER;
+    }
+  }
+  return (TokenType)keyword->type;
+}
+
+/* ---- Tokens ---- */
+
+static Token scan_string(Scanner* scanner) {
+  scanner->current = skip_string(scanner->current, &scanner->line);
+
+  if (is_eof(scanner)) {
+    return make_error(scanner, "unterminated string");
   }
 
-  return TOKEN_IDENTIFIER;
+  // The closing quote
+  advance(scanner);
+  return make_token(scanner, TOKEN_STRING);
 }
 
-static Token scan_identifier(void) {
-  while (is_alpha(peek()) || is_digit(peek())) {
-    advance();
+static Token scan_number(Scanner* scanner) {
+  while (is_digit(peek(scanner))) {
+    advance(scanner);
+  }
+
+  // Look for a fractional part
+  if (peek(scanner) == '.' && is_digit(peek_next(scanner))) {
+    // Consume the dot
+    advance(scanner);
+
+    while (is_digit(peek(scanner))) {
+      advance(scanner);
+    }
   }
 
-  return make_token(identifier_type());
+  return make_token(scanner, TOKEN_NUMBER);
 }
 
-static void skip_whitespace(void) {
+static Token scan_identifier(Scanner* scanner) {
+  scanner->current = skip_identifier(scanner->current);
+  size_t length = (size_t)(scanner->current - scanner->start);
+  return make_token(scanner, identifier_type(scanner->start, length));
+}
+
+static void skip_whitespace(Scanner* scanner) {
   for (;;) {
-    char c = peek();
-    switch (c) {
-      case ' ':
-      case '\t':
-      case '\r':
-        advance();
-        break;
-      case '\n':
-        scanner.line++;
-        advance();
+    switch (char_class(peek(scanner))) {
+      case CHAR_BLANK:
+      case CHAR_NEWLINE:
+        scanner->current = skip_blanks(scanner->current, &scanner->line);
         break;
-      case '/':
-        if (peek_next() == '/') {
-          // A comment goes until the end of the line
-          while (peek() != '\n' && !is_eof()) {
-            advance();
-          }
-        } else {
+      case CHAR_SLASH:
+        if (peek_next(scanner) != '/') {
           return;
         }
+        // A comment goes until the end of the line
+        scanner->current = skip_comment(scanner->current + 2);
         break;
       default:
         return;
@@ -197,58 +448,35 @@ static void skip_whitespace(void) {
   }
 }
 
-Token scan_token(void) {
-  skip_whitespace();
-  scanner.start = scanner.current;
-
-  if (is_eof()) {
-    return make_token(TOKEN_EOF);
-  }
-
-  char c = advance();
-  if (is_alpha(c)) {
-    return scan_identifier();
-  }
-  if (is_digit(c)) {
-    return scan_number();
-  }
-
-  switch (c) {
-    case '(':
-      return make_token(TOKEN_LEFT_PAREN);
-    case ')':
-      return make_token(TOKEN_RIGHT_PAREN);
-    case '{':
-      return make_token(TOKEN_LEFT_BRACE);
-    case '}':
-      return make_token(TOKEN_RIGHT_BRACE);
-    case ',':
-      return make_token(TOKEN_COMMA);
-    case '.':
-      return make_token(TOKEN_DOT);
-    case '-':
-      return make_token(TOKEN_MINUS);
-    case '+':
-      return make_token(TOKEN_PLUS);
-    case ';':
-      return make_token(TOKEN_SEMICOLON);
-    case '/':
-      return make_token(TOKEN_SLASH);
-    case '*':
-      return make_token(TOKEN_STAR);
-    case '!':
-      return match('=') ? make_token(TOKEN_BANG_EQUAL) : make_token(TOKEN_BANG);
-    case '=':
-      return match('=') ? make_token(TOKEN_EQUAL_EQUAL)
-                        : make_token(TOKEN_EQUAL);
-    case '<':
-      return match('=') ? make_token(TOKEN_LESS_EQUAL) : make_token(TOKEN_LESS);
-    case '>':
-      return match('=') ? make_token(TOKEN_GREATER_EQUAL)
-                        : make_token(TOKEN_GREATER);
-    case '"':
-      return scan_string();
-  }
-
-  return make_error("unexpected character");
+Token scan_token(Scanner* scanner) {
+  skip_whitespace(scanner);
+  scanner->start = scanner->current;
+
+  char c = advance(scanner);
+  switch (char_class(c)) {
+    case CHAR_END:
+      // Stay on the terminator, so scanning again gives another EOF
+      scanner->current--;
+      return make_token(scanner, TOKEN_EOF);
+    case CHAR_ALPHA:
+      return scan_identifier(scanner);
+    case CHAR_DIGIT:
+      return scan_number(scanner);
+    case CHAR_QUOTE:
+      return scan_string(scanner);
+    case CHAR_SLASH:
+    case CHAR_SINGLE:
+      return make_token(scanner, (TokenType)char_tokens[(uint8_t)c]);
+    case CHAR_PAIR: {
+      TokenType type = (TokenType)char_tokens[(uint8_t)c];
+      return make_token(scanner,
+                        match(scanner, '=') ? (TokenType)(type + 1) : type);
+    }
+    case CHAR_OTHER:
+    case CHAR_BLANK:
+    case CHAR_NEWLINE:
+      break;
+  }
+
+  return make_error(scanner, "unexpected character");
 }
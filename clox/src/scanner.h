@@ -57,7 +57,13 @@ typedef struct {
 
 } Token;
 
-void scanner_init(const char* source);
-Token scan_token(void);
+typedef struct {
+  const char* start;
+  const char* current;
+  int line;
+} Scanner;
+
+void scanner_init(Scanner* scanner, const char* source);
+Token scan_token(Scanner* scanner);
 
 #endif
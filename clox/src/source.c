@@ -0,0 +1,173 @@
+// MAP_ANON is not part of POSIX
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source.h"
+
+#define READ_CHUNK_SIZE 65536
+
+void source_init(Source* source) {
+  source->text = NULL;
+  source->length = 0;
+  source->mapped_size = 0;
+  source->capacity = 0;
+}
+
+// Maps the file read-only. The scanner relies on a '\0' after the last
+// character: the kernel zero-fills the tail of the last page, unless the
+// file ends exactly on a page boundary. In that case the file is mapped over
+// a slightly larger anonymous mapping, whose extra page reads as zeros.
+static bool map_file(Source* source, int fd, size_t size) {
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t mapped_size = size;
+  char* text;
+
+  if (size % page_size != 0) {
+    text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED) {
+      return false;
+    }
+  } else {
+    mapped_size = size + page_size;
+    text = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (text == MAP_FAILED) {
+      return false;
+    }
+    if (mmap(text, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+        MAP_FAILED) {
+      munmap(text, mapped_size);
+      return false;
+    }
+  }
+
+  posix_madvise(text, size, POSIX_MADV_SEQUENTIAL);
+
+  source->text = text;
+  source->length = size;
+  source->mapped_size = mapped_size;
+  return true;
+}
+
+bool source_open(Source* source, const char* path) {
+  source_free(source);
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+  // Regular, non-empty files are mapped. Anything else, or a failed
+  // mapping, is streamed into memory instead.
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      map_file(source, fd, (size_t)st.st_size)) {
+    close(fd);
+    return true;
+  }
+
+  FILE* f = fdopen(fd, "rb");
+  if (f == NULL) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+
+  bool ok = source_read_stream(source, f);
+  int err = errno;
+  fclose(f);
+  errno = err;
+  return ok;
+}
+
+static bool reserve(Source* source, size_t capacity) {
+  if (source->capacity >= capacity) {
+    return true;
+  }
+
+  size_t new_capacity = source->capacity < 64 ? 64 : source->capacity;
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+
+  char* text = realloc((char*)source->text, new_capacity);
+  if (text == NULL) {
+    errno = ENOMEM;
+    return false;
+  }
+  source->text = text;
+  source->capacity = new_capacity;
+  return true;
+}
+
+bool source_read_stream(Source* source, FILE* stream) {
+  source_free(source);
+
+  for (;;) {
+    if (!reserve(source, source->length + READ_CHUNK_SIZE + 1)) {
+      return false;
+    }
+
+    char* text = (char*)source->text;
+    errno = 0;
+    size_t count = fread(text + source->length, 1, READ_CHUNK_SIZE, stream);
+    source->length += count;
+    text[source->length] = '\0';
+
+    if (count < READ_CHUNK_SIZE) {
+      if (ferror(stream)) {
+        if (errno == 0) {
+          errno = EIO;
+        }
+        return false;
+      }
+      return true;
+    }
+  }
+}
+
+bool source_read_line(Source* source, FILE* stream) {
+  // The heap buffer is reused from one line to the next
+  if (source->mapped_size != 0) {
+    source_free(source);
+  }
+  source->length = 0;
+
+  for (;;) {
+    if (!reserve(source, source->length + 256)) {
+      return false;
+    }
+
+    char* text = (char*)source->text;
+    size_t available = source->capacity - source->length;
+    if (available > INT_MAX) {
+      available = INT_MAX;
+    }
+    if (fgets(text + source->length, (int)available, stream) == NULL) {
+      // A final line without a newline still counts
+      return source->length > 0;
+    }
+
+    source->length += strlen(text + source->length);
+    if (text[source->length - 1] == '\n') {
+      return true;
+    }
+  }
+}
+
+void source_free(Source* source) {
+  if (source->mapped_size != 0) {
+    munmap((char*)source->text, source->mapped_size);
+  } else {
+    free((char*)source->text);
+  }
+  source_init(source);
+}
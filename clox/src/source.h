@@ -0,0 +1,24 @@
+#ifndef clox_source_h
+#define clox_source_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+// Source text handed to the scanner. The text is always followed by a '\0'
+// terminator, whether it is mapped from a file or read into the heap.
+typedef struct {
+  const char* text;
+  size_t length;
+  // Size of the mapping backing `text`, or 0 if `text` is on the heap
+  size_t mapped_size;
+  size_t capacity;
+} Source;
+
+void source_init(Source* source);
+bool source_open(Source* source, const char* path);
+bool source_read_stream(Source* source, FILE* stream);
+bool source_read_line(Source* source, FILE* stream);
+void source_free(Source* source);
+
+#endif
@@ -0,0 +1,316 @@
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+
+#ifdef SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// Control bytes. Full slots hold the low 7 bits of their key's hash, so the
+// top bit alone tells free slots from full ones.
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xfe
+
+// Index of the lowest set bit in a non-zero mask
+static int ctz(uint64_t mask) {
+#ifdef __GNUC__
+  return __builtin_ctzll(mask);
+#else
+  int bit = 0;
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+// Live entries plus tombstones are kept at or below 7/8 of the capacity
+#define MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+/* ---- Group Scanning ---- */
+
+// Each function returns a bitmask of the slots in a group whose control
+// byte matches, which lowest_slot() turns back into slot indexes.
+
+#ifdef SIMD_SSE2
+
+// One bit per slot
+typedef uint32_t GroupMask;
+
+static GroupMask match_byte(const uint8_t* group, uint8_t byte) {
+  __m128i control = _mm_loadu_si128((const __m128i*)group);
+  __m128i match = _mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte));
+  return (GroupMask)_mm_movemask_epi8(match);
+}
+
+static GroupMask match_free(const uint8_t* group) {
+  __m128i control = _mm_loadu_si128((const __m128i*)group);
+  return (GroupMask)_mm_movemask_epi8(control);
+}
+
+static GroupMask match_empty(const uint8_t* group) {
+  return match_byte(group, CONTROL_EMPTY);
+}
+
+static int lowest_slot(GroupMask mask) { return ctz(mask); }
+
+#else
+
+// The top bit of each slot's byte, working on the group as one 64-bit word
+typedef uint64_t GroupMask;
+
+#define LSBS UINT64_C(0x0101010101010101)
+#define MSBS UINT64_C(0x8080808080808080)
+
+static uint64_t load_group(const uint8_t* group) {
+  uint64_t word;
+  memcpy(&word, group, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+// May report a false match on a full slot just above a real match, which
+// callers rule out by comparing keys
+static GroupMask match_byte(const uint8_t* group, uint8_t byte) {
+  uint64_t word = load_group(group) ^ (LSBS * byte);
+  return (word - LSBS) & ~word & MSBS;
+}
+
+static GroupMask match_free(const uint8_t* group) {
+  return load_group(group) & MSBS;
+}
+
+// Empty has the top bit set and bit 1 clear, unlike deleted
+static GroupMask match_empty(const uint8_t* group) {
+  uint64_t word = load_group(group);
+  return word & ~(word << 6) & MSBS;
+}
+
+static int lowest_slot(GroupMask mask) { return ctz(mask) / 8; }
+
+#endif
+
+/* ---- Probing ---- */
+
+// The high bits of the hash pick the first group to probe, the low 7 are
+// stored in the control byte
+static size_t hash_group(uint32_t hash) { return hash >> 7; }
+static uint8_t hash_control(uint32_t hash) { return hash & 0x7f; }
+
+// Groups are probed in triangular order, which visits every group once when
+// the number of groups is a power of two. Probing stops at the first group
+// with an empty slot: an insert would have used it.
+typedef struct {
+  size_t mask;
+  size_t group;
+  size_t stride;
+} Probe;
+
+static Probe probe_start(Table* table, uint32_t hash) {
+  size_t mask = table->capacity / TABLE_GROUP_SIZE - 1;
+  return (Probe){.mask = mask, .group = hash_group(hash) & mask, .stride = 0};
+}
+
+static void probe_next(Probe* probe) {
+  probe->stride++;
+  probe->group = (probe->group + probe->stride) & probe->mask;
+}
+
+static uint8_t* probe_control(Table* table, Probe* probe) {
+  return &table->control[probe->group * TABLE_GROUP_SIZE];
+}
+
+static Entry* probe_entry(Table* table, Probe* probe, int slot) {
+  return &table->entries[probe->group * TABLE_GROUP_SIZE + (size_t)slot];
+}
+
+static Entry* find_entry(Table* table, ObjString* key) {
+  uint8_t control = hash_control(key->hash);
+  for (Probe probe = probe_start(table, key->hash);; probe_next(&probe)) {
+    uint8_t* group = probe_control(table, &probe);
+    for (GroupMask match = match_byte(group, control); match != 0;
+         match &= match - 1) {
+      Entry* entry = probe_entry(table, &probe, lowest_slot(match));
+      if (entry->key == key) {
+        return entry;
+      }
+    }
+    if (match_empty(group) != 0) {
+      return NULL;
+    }
+  }
+}
+
+// Marks the first free slot on `hash`'s probe sequence as full and returns
+// its entry. There must be one.
+static Entry* claim_slot(Table* table, uint32_t hash) {
+  for (Probe probe = probe_start(table, hash);; probe_next(&probe)) {
+    uint8_t* group = probe_control(table, &probe);
+    GroupMask free = match_free(group);
+    if (free != 0) {
+      int slot = lowest_slot(free);
+      if (group[slot] == CONTROL_DELETED) {
+        table->tombstones--;
+      }
+      group[slot] = hash_control(hash);
+      table->count++;
+      return probe_entry(table, &probe, slot);
+    }
+  }
+}
+
+static void delete_slot(Table* table, size_t index) {
+  // Probing never continues past a group with an empty slot, so if this
+  // group has one, no probe sequence depends on the deleted slot and it can
+  // become empty again instead of leaving a tombstone
+  uint8_t* group = &table->control[index & ~(size_t)(TABLE_GROUP_SIZE - 1)];
+  if (match_empty(group) != 0) {
+    table->control[index] = CONTROL_EMPTY;
+  } else {
+    table->control[index] = CONTROL_DELETED;
+    table->tombstones++;
+  }
+  table->count--;
+}
+
+/* ---- Resizing ---- */
+
+static size_t allocation_size(size_t capacity) {
+  return capacity * (sizeof(Entry) + 1);
+}
+
+// Rebuilds the table with the given capacity, dropping all tombstones
+static bool resize(Table* table, size_t capacity) {
+  Entry* entries = reallocate(table->allocator, MEMORY_TABLES, NULL, 0,
+                              allocation_size(capacity));
+  if (entries == NULL) {
+    return false;
+  }
+
+  Table old = *table;
+  table->capacity = capacity;
+  table->count = 0;
+  table->tombstones = 0;
+  table->entries = entries;
+  table->control = (uint8_t*)(entries + capacity);
+  memset(table->control, CONTROL_EMPTY, capacity);
+
+  for (size_t i = 0; i < old.capacity; i++) {
+    if (old.control[i] & 0x80) {
+      continue;
+    }
+    Entry* entry = &old.entries[i];
+    *claim_slot(table, entry->key->hash) = *entry;
+  }
+
+  reallocate(table->allocator, MEMORY_TABLES, old.entries,
+             allocation_size(old.capacity), 0);
+  return true;
+}
+
+// Makes room for one more entry. When most of the used slots are
+// tombstones the table is rebuilt at the same size rather than grown, so
+// churn from inserts and deletes doesn't keep doubling it.
+static bool reserve(Table* table) {
+  if (table->count + table->tombstones < MAX_LOAD(table->capacity)) {
+    return true;
+  }
+
+  size_t capacity = table->capacity;
+  if (capacity == 0) {
+    capacity = TABLE_GROUP_SIZE;
+  } else if (table->count >= MAX_LOAD(capacity) / 2) {
+    capacity *= 2;
+  }
+  return resize(table, capacity);
+}
+
+/* ---- Table Interface ---- */
+
+void table_init(Table* table, Allocator* allocator) {
+  table->allocator = allocator;
+  table->count = 0;
+  table->tombstones = 0;
+  table->capacity = 0;
+  table->control = NULL;
+  table->entries = NULL;
+}
+
+void table_free(Table* table) {
+  reallocate(table->allocator, MEMORY_TABLES, table->entries,
+             allocation_size(table->capacity), 0);
+  table_init(table, table->allocator);
+}
+
+bool table_get(Table* table, ObjString* key, Value* value) {
+  if (table->count == 0) {
+    return false;
+  }
+
+  Entry* entry = find_entry(table, key);
+  if (entry == NULL) {
+    return false;
+  }
+
+  *value = entry->value;
+  return true;
+}
+
+bool table_set(Table* table, ObjString* key, Value value) {
+  Entry* entry = table->count == 0 ? NULL : find_entry(table, key);
+  if (entry == NULL) {
+    if (!reserve(table)) {
+      return false;
+    }
+    entry = claim_slot(table, key->hash);
+    entry->key = key;
+  }
+
+  entry->value = value;
+  return true;
+}
+
+bool table_delete(Table* table, ObjString* key) {
+  if (table->count == 0) {
+    return false;
+  }
+
+  Entry* entry = find_entry(table, key);
+  if (entry == NULL) {
+    return false;
+  }
+
+  delete_slot(table, (size_t)(entry - table->entries));
+  return true;
+}
+
+ObjString* table_find_string(Table* table, const char* prefix,
+                             size_t prefix_length, const char* suffix,
+                             size_t suffix_length, uint32_t hash) {
+  if (table->count == 0) {
+    return NULL;
+  }
+
+  size_t length = prefix_length + suffix_length;
+  uint8_t control = hash_control(hash);
+  for (Probe probe = probe_start(table, hash);; probe_next(&probe)) {
+    uint8_t* group = probe_control(table, &probe);
+    for (GroupMask match = match_byte(group, control); match != 0;
+         match &= match - 1) {
+      ObjString* key = probe_entry(table, &probe, lowest_slot(match))->key;
+      if (key->hash == hash && key->length == length &&
+          memcmp(key->chars, prefix, prefix_length) == 0 &&
+          memcmp(key->chars + prefix_length, suffix, suffix_length) == 0) {
+        return key;
+      }
+    }
+    if (match_empty(group) != 0) {
+      return NULL;
+    }
+  }
+}
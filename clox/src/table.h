@@ -0,0 +1,48 @@
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "common.h"
+#include "value.h"
+
+// Hash table keyed by interned strings, so keys are compared by pointer.
+//
+// The layout follows Swiss tables: slots are split into groups of
+// TABLE_GROUP_SIZE, and each slot has a control byte holding either 7 bits
+// of its key's hash, or a marker for an empty or deleted slot. Lookups scan
+// a whole group of control bytes at once, as one SSE2 vector or as one
+// 64-bit word, and only look at entries whose hash bits match.
+#ifdef SIMD_SSE2
+#define TABLE_GROUP_SIZE 16
+#else
+#define TABLE_GROUP_SIZE 8
+#endif
+
+typedef struct {
+  ObjString* key;
+  Value value;
+} Entry;
+
+typedef struct {
+  Allocator* allocator;
+  size_t count;       // Live entries
+  size_t tombstones;  // Deleted entries still marked in the control bytes
+  size_t capacity;    // Zero, or a power of two no less than a group
+  // Control bytes live in the same allocation, right after the entries
+  uint8_t* control;
+  Entry* entries;
+} Table;
+
+void table_init(Table* table, Allocator* allocator);
+void table_free(Table* table);
+bool table_get(Table* table, ObjString* key, Value* value);
+// Returns false if the table needed to grow and memory ran out
+bool table_set(Table* table, ObjString* key, Value value);
+bool table_delete(Table* table, ObjString* key);
+
+// Looks up the interned string whose characters are `prefix` followed by
+// `suffix`, without building it first
+ObjString* table_find_string(Table* table, const char* prefix,
+                             size_t prefix_length, const char* suffix,
+                             size_t suffix_length, uint32_t hash);
+
+#endif
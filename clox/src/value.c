@@ -1,41 +1,65 @@
 #include <stdio.h>
 
 #include "memory.h"
+#include "object.h"
+#include "output.h"
 #include "value.h"
 
+void value_write(Output* output, Value value) {
+  if (IS_NIL(value)) {
+    output_write(output, "nil", 3);
+  } else if (IS_BOOL(value)) {
+    if (AS_BOOL(value)) {
+      output_write(output, "true", 4);
+    } else {
+      output_write(output, "false", 5);
+    }
+  } else if (IS_NUMBER(value)) {
+    output_number(output, AS_NUMBER(value));
+  } else if (IS_OBJ(value)) {
+    object_write(output, value);
+  }
+}
+
 void value_print(Value value) {
-  switch (value.type) {
-    case VAL_NIL:
-      printf("nil");
-      break;
-    case VAL_BOOL:
-      printf(AS_BOOL(value) ? "true" : "false");
-      break;
-    case VAL_NUMBER:
-      printf("%g", AS_NUMBER(value));
-      break;
+  if (IS_NIL(value)) {
+    printf("nil");
+  } else if (IS_BOOL(value)) {
+    printf(AS_BOOL(value) ? "true" : "false");
+  } else if (IS_NUMBER(value)) {
+    printf("%g", AS_NUMBER(value));
+  } else if (IS_OBJ(value)) {
+    object_print(value);
   }
 }
 
-void valuearray_init(ValueArray* array) {
+void valuearray_init(ValueArray* array, Allocator* allocator) {
+  array->allocator = allocator;
   array->capacity = 0;
   array->count = 0;
   array->values = NULL;
 }
 
-void valuearray_write(ValueArray* array, Value value) {
+bool valuearray_write(ValueArray* array, Value value) {
   if (array->capacity < array->count + 1) {
     size_t old_capacity = array->capacity;
-    array->capacity = GROW_CAPACITY(old_capacity);
-    array->values =
-        GROW_ARRAY(Value, array->values, old_capacity, array->capacity);
+    size_t capacity = GROW_CAPACITY(old_capacity);
+    Value* values = GROW_ARRAY(array->allocator, MEMORY_CONSTANTS, Value,
+                               array->values, old_capacity, capacity);
+    if (values == NULL) {
+      return false;
+    }
+    array->values = values;
+    array->capacity = capacity;
   }
 
   array->values[array->count] = value;
   array->count++;
+  return true;
 }
 
 void valuearray_free(ValueArray* array) {
-  FREE_ARRAY(Value, array->values, array->capacity);
-  valuearray_init(array);
+  FREE_ARRAY(array->allocator, MEMORY_CONSTANTS, Value, array->values,
+             array->capacity);
+  valuearray_init(array, array->allocator);
 }
@@ -1,12 +1,94 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <math.h>
+
 #include "common.h"
+#include "memory.h"
+
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+typedef struct Output Output;
+
+#ifdef NAN_BOXING
+
+#include <string.h>
+
+// Values are stored as IEEE 754 doubles. Anything that isn't a number is
+// encoded as a quiet NaN, with a small tag in the low bits of the mantissa.
+// Objects set the sign bit as well, and keep their pointer in the mantissa.
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_UNDEFINED 0  // 00
+#define TAG_NIL 1        // 01
+#define TAG_FALSE 2      // 10
+#define TAG_TRUE 3       // 11
+
+// Integers are quiet NaNs with this bit set, and the integer in the low 48
+// bits, in two's complement
+#define INTEGER_TAG ((uint64_t)0x0002000000000000)
+#define INTEGER_PAYLOAD ((uint64_t)0x0000ffffffffffff)
+#define INTEGER_MIN (-((int64_t)1 << 47))
+#define INTEGER_MAX (((int64_t)1 << 47) - 1)
+
+typedef uint64_t Value;
+
+#define FALSE_BITS ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_BITS ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_BITS ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_BITS ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+
+#define IS_BOOL(v) (((v) | 1) == TRUE_BITS)
+#define IS_NIL(v) ((v) == NIL_BITS)
+#define IS_UNDEFINED(v) ((v) == UNDEFINED_BITS)
+#define IS_DOUBLE(v) (((v) & QNAN) != QNAN)
+#define IS_INTEGER(v) \
+  (((v) & (SIGN_BIT | QNAN | INTEGER_TAG)) == (QNAN | INTEGER_TAG))
+#define IS_NUMBER(v) (IS_DOUBLE(v) || IS_INTEGER(v))
+#define IS_OBJ(v) (((v) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_BOOL(v) ((v) == TRUE_BITS)
+#define AS_DOUBLE(v) value_to_number(v)
+#define AS_INTEGER(v) value_to_integer(v)
+#define AS_OBJ(v) ((Obj*)(uintptr_t)((v) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VALUE(b) ((b) ? TRUE_BITS : FALSE_BITS)
+#define NIL_VALUE() NIL_BITS
+#define UNDEFINED_VALUE() UNDEFINED_BITS
+#define NUMBER_VALUE(n) number_to_value(n)
+#define INTEGER_VALUE(i) \
+  ((Value)(QNAN | INTEGER_TAG | ((uint64_t)(i) & INTEGER_PAYLOAD)))
+#define OBJ_VALUE(o) ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(o)))
+
+static inline double value_to_number(Value value) {
+  double number;
+  memcpy(&number, &value, sizeof(Value));
+  return number;
+}
+
+static inline Value number_to_value(double number) {
+  Value value;
+  memcpy(&value, &number, sizeof(double));
+  return value;
+}
+
+static inline int64_t value_to_integer(Value value) {
+  // Sign-extends the payload
+  uint64_t sign = (uint64_t)1 << 47;
+  return (int64_t)((value & INTEGER_PAYLOAD) ^ sign) - (int64_t)sign;
+}
+
+#else
 
 typedef enum {
   VAL_BOOL,
   VAL_NIL,
-  VAL_NUMBER,
+  // These two only differ in the lowest bit
+  VAL_DOUBLE = 2,
+  VAL_INTEGER = 3,
+  VAL_OBJ,
+  VAL_UNDEFINED,
 } ValueType;
 
 typedef struct {
@@ -14,30 +96,79 @@ typedef struct {
   union {
     bool boolean;
     double number;
+    int64_t integer;
+    Obj* obj;
   } as;
 } Value;
 
 #define IS_BOOL(v) ((v).type == VAL_BOOL)
 #define IS_NIL(v) ((v).type == VAL_NIL)
-#define IS_NUMBER(v) ((v).type == VAL_NUMBER)
+#define IS_UNDEFINED(v) ((v).type == VAL_UNDEFINED)
+#define IS_DOUBLE(v) ((v).type == VAL_DOUBLE)
+#define IS_INTEGER(v) ((v).type == VAL_INTEGER)
+#define IS_NUMBER(v) (((v).type | 1) == VAL_INTEGER)
+#define IS_OBJ(v) ((v).type == VAL_OBJ)
 
 #define AS_BOOL(v) ((v).as.boolean)
-#define AS_NUMBER(v) ((v).as.number)
+#define AS_DOUBLE(v) ((v).as.number)
+#define AS_INTEGER(v) ((v).as.integer)
+#define AS_OBJ(v) ((v).as.obj)
 
 #define BOOL_VALUE(b) ((Value){.type = VAL_BOOL, .as.boolean = (b)})
 #define NIL_VALUE() ((Value){.type = VAL_NIL, .as.number = 0})
-#define NUMBER_VALUE(n) ((Value){.type = VAL_NUMBER, .as.number = (n)})
+#define UNDEFINED_VALUE() ((Value){.type = VAL_UNDEFINED, .as.number = 0})
+#define NUMBER_VALUE(n) ((Value){.type = VAL_DOUBLE, .as.number = (n)})
+#define INTEGER_VALUE(i) ((Value){.type = VAL_INTEGER, .as.integer = (i)})
+#define OBJ_VALUE(o) ((Value){.type = VAL_OBJ, .as.obj = (Obj*)(o)})
+
+// Integers up to 2^53 are all exactly representable as doubles
+#define INTEGER_MIN (-((int64_t)1 << 53))
+#define INTEGER_MAX ((int64_t)1 << 53)
+
+#endif
+
+// UNDEFINED_VALUE() is never seen by Lox code. It marks global variables
+// that have been referred to but not yet defined.
+
+// Lox has one number type, but numbers that are integers between
+// INTEGER_MIN and INTEGER_MAX can be stored as INTEGER_VALUE()s, which the
+// VM adds, subtracts and multiplies without converting them to doubles.
+// IS_NUMBER() is true of both kinds, and AS_NUMBER() reads either as a
+// double.
+// The range is within 2^53, so integer results are exactly what double
+// arithmetic would give; results outside it are computed as doubles.
+#define AS_NUMBER(v) value_as_number(v)
+
+static inline double value_as_number(Value value) {
+  return IS_INTEGER(value) ? (double)AS_INTEGER(value) : AS_DOUBLE(value);
+}
+
+// Stores `number` as an integer if it is one that fits, or as a double.
+// -0 stays a double, so that it still prints as "-0".
+static inline Value value_from_double(double number) {
+  if (number >= (double)INTEGER_MIN && number <= (double)INTEGER_MAX) {
+    int64_t integer = (int64_t)number;
+    if ((double)integer == number && (integer != 0 || !signbit(number))) {
+      return INTEGER_VALUE(integer);
+    }
+  }
+  return NUMBER_VALUE(number);
+}
 
+// value_write() is what OP_PRINT uses. value_print() goes straight to
+// stdout, for the disassembler and tracing.
+void value_write(Output* output, Value value);
 void value_print(Value value);
 
 typedef struct {
+  Allocator* allocator;
   size_t count;
   size_t capacity;
   Value* values;
 } ValueArray;
 
-void valuearray_init(ValueArray* array);
-void valuearray_write(ValueArray* array, Value value);
+void valuearray_init(ValueArray* array, Allocator* allocator);
+bool valuearray_write(ValueArray* array, Value value);
 void valuearray_free(ValueArray* array);
 
 #endif
@@ -1,130 +1,670 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "memory.h"
+#include "object.h"
 #include "vm.h"
 
-VM vm;
+uint64_t clock_nanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void reset_stack(VM* vm) { vm->stack_top = vm->stack; }
 
-static void reset_stack(void) { vm.stack_top = vm.stack; }
+static void runtime_error(VM* vm, const char* format, ...) {
+  // Whatever the script printed comes before the error
+  output_flush(&vm->output);
 
-static void runtime_error(const char* format, ...) {
   va_list args;
   va_start(args, format);
   vfprintf(stderr, format, args);
   va_end(args);
   fputs("\n", stderr);
 
-  size_t instruction = ((size_t)(vm.ip - vm.chunk->code)) - 1;
-  size_t line = vm.chunk->lines[instruction];
+  size_t instruction = (vm->ip > vm->chunk->code)
+                           ? (size_t)(vm->ip - vm->chunk->code) - 1
+                           : 0;
+  size_t line = chunk_get_line(vm->chunk, instruction);
   fprintf(stderr, "[line %lu] in script\n", line);
-  reset_stack();
+  reset_stack(vm);
 }
 
-void vm_init(void) { reset_stack(); }
+// Makes room for `count` more values above the top of the stack. Returns
+// false if that would take the stack past its limit, or if memory runs out.
+static bool reserve_stack(VM* vm, size_t count) {
+  size_t depth = (size_t)(vm->stack_top - vm->stack);
+  size_t needed = depth + count;
+  if (needed <= vm->stack_capacity) {
+    return true;
+  }
+  if (needed > vm->stack_limit) {
+    return false;
+  }
+
+  size_t old_capacity = vm->stack_capacity;
+  size_t capacity = old_capacity < STACK_MIN ? STACK_MIN : old_capacity;
+  while (capacity < needed) {
+    capacity *= 2;
+  }
+  if (capacity > vm->stack_limit) {
+    capacity = vm->stack_limit;
+  }
+
+  Value* stack = GROW_ARRAY(vm->allocator, MEMORY_STACK, Value, vm->stack,
+                            old_capacity, capacity);
+  if (stack == NULL) {
+    return false;
+  }
+  vm->stack = stack;
+  vm->stack_capacity = capacity;
+  vm->stack_top = vm->stack + depth;
+  return true;
+}
 
-void vm_free(void) {}
+// Values and names share one allocation, values first
+static size_t globals_size(size_t capacity) {
+  return capacity * (sizeof(Value) + sizeof(ObjString*));
+}
 
-void push(Value value) {
-  *vm.stack_top = value;
-  vm.stack_top++;
+static void globals_init(Globals* globals, Allocator* allocator) {
+  table_init(&globals->slots, allocator);
+  globals->names = NULL;
+  globals->values = NULL;
+  globals->count = 0;
+  globals->capacity = 0;
 }
 
-Value pop(void) {
-  vm.stack_top--;
-  return *vm.stack_top;
+static void globals_free(Globals* globals, Allocator* allocator) {
+  table_free(&globals->slots);
+  reallocate(allocator, MEMORY_GLOBALS, globals->values,
+             globals_size(globals->capacity), 0);
+  globals_init(globals, allocator);
 }
 
-Value peek(int distance) { return vm.stack_top[-1 - distance]; }
+size_t vm_global_slot(VM* vm, ObjString* name) {
+  Globals* globals = &vm->globals;
+  Value slot;
+  if (table_get(&globals->slots, name, &slot)) {
+    return (size_t)AS_INTEGER(slot);
+  }
 
-static InterpretResult run(void) {
-#define READ_BYTE() (*vm.ip++)
-#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-#define BINARY_OP(as_value, op)                       \
-  do {                                                \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-      runtime_error("operands must be numbers");      \
-      return INTERPRET_RUNTIME_ERROR;                 \
-    }                                                 \
-    double r = AS_NUMBER(pop());                      \
-    double l = AS_NUMBER(pop());                      \
-    push(as_value(l op r));                           \
+  if (globals->capacity < globals->count + 1) {
+    size_t capacity = GROW_CAPACITY(globals->capacity);
+    Value* values = reallocate(vm->allocator, MEMORY_GLOBALS, NULL, 0,
+                               globals_size(capacity));
+    if (values == NULL) {
+      return SIZE_MAX;
+    }
+    ObjString** names = (ObjString**)(values + capacity);
+    if (globals->count > 0) {
+      memcpy(values, globals->values, globals->count * sizeof(Value));
+      memcpy(names, globals->names, globals->count * sizeof(ObjString*));
+    }
+    reallocate(vm->allocator, MEMORY_GLOBALS, globals->values,
+               globals_size(globals->capacity), 0);
+    globals->values = values;
+    globals->names = names;
+    globals->capacity = capacity;
+  }
+
+  size_t index = globals->count;
+  if (!table_set(&globals->slots, name, INTEGER_VALUE((int64_t)index))) {
+    return SIZE_MAX;
+  }
+  globals->names[index] = name;
+  globals->values[index] = UNDEFINED_VALUE();
+  globals->count++;
+  return index;
+}
+
+void vm_init(VM* vm, Allocator* allocator) {
+  gc_init(&vm->gc, allocator);
+  allocator = &vm->gc.allocator;
+  vm->allocator = allocator;
+  vm->chunk = NULL;
+  vm->ip = NULL;
+  vm->stack = NULL;
+  vm->stack_capacity = 0;
+  vm->stack_limit = STACK_LIMIT_DEFAULT;
+  table_init(&vm->strings, allocator);
+  globals_init(&vm->globals, allocator);
+  vm->objects = NULL;
+  output_init(&vm->output, stdout);
+  vm->profile = NULL;
+  vm->compile_time = 0;
+  vm->run_time = 0;
+  reset_stack(vm);
+}
+
+void vm_free(VM* vm) {
+  output_flush(&vm->output);
+  Obj* object = vm->objects;
+  while (object != NULL) {
+    Obj* next = object->next;
+    object_free(vm, object);
+    object = next;
+  }
+  table_free(&vm->strings);
+  globals_free(&vm->globals, vm->allocator);
+  FREE_ARRAY(vm->allocator, MEMORY_STACK, Value, vm->stack,
+             vm->stack_capacity);
+  gc_free(&vm->gc);
+  vm_init(vm, vm->gc.parent);
+}
+
+bool push(VM* vm, Value value) {
+  if (!reserve_stack(vm, 1)) {
+    return false;
+  }
+  *vm->stack_top = value;
+  vm->stack_top++;
+  return true;
+}
+
+Value pop(VM* vm) {
+  vm->stack_top--;
+  return *vm->stack_top;
+}
+
+// Integer arithmetic for run(). Each returns false if the exact result
+// isn't an integer from INTEGER_MIN to INTEGER_MAX, and the caller computes
+// it with doubles instead.
+static inline bool integer_add(int64_t a, int64_t b, int64_t* result) {
+  // Both are within 2^53, so this can't overflow
+  *result = a + b;
+  return *result >= INTEGER_MIN && *result <= INTEGER_MAX;
+}
+
+static inline bool integer_subtract(int64_t a, int64_t b, int64_t* result) {
+  *result = a - b;
+  return *result >= INTEGER_MIN && *result <= INTEGER_MAX;
+}
+
+static inline bool integer_multiply(int64_t a, int64_t b, int64_t* result) {
+#ifdef __GNUC__
+  if (__builtin_mul_overflow(a, b, result)) {
+    return false;
+  }
+#else
+  // The rounded product is close enough to tell whether the exact one fits
+  double product = (double)a * (double)b;
+  if (product > 0x1p62 || product < -0x1p62) {
+    return false;
+  }
+  *result = a * b;
+#endif
+  // Zero times a negative number is -0, which only a double can hold
+  if (*result == 0 && (a < 0 || b < 0)) {
+    return false;
+  }
+  return *result >= INTEGER_MIN && *result <= INTEGER_MAX;
+}
+
+static InterpretResult run(VM* vm) {
+  // Hot interpreter state lives in locals so the compiler can keep it in
+  // registers. It is written back to the VM before anything that reads it from
+  // there, such as runtime_error().
+  uint8_t* ip = vm->ip;
+  Value* stack_top = vm->stack_top;
+  Value* constants = vm->chunk->constants.values;
+  // Only the compiler adds globals, so the array can't move while running
+  Value* globals = vm->globals.values;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (size_t)ip[-2] | (size_t)ip[-1] << 8)
+#define READ_CONSTANT() (constants[READ_BYTE()])
+#define READ_CONSTANT_LONG()                                 \
+  (ip += 3, constants[(size_t)ip[-3] | (size_t)ip[-2] << 8 | \
+                      (size_t)ip[-1] << 16])
+#define PUSH(value) (*stack_top++ = (value))
+#define POP() (*--stack_top)
+#define PEEK(distance) (stack_top[-1 - (distance)])
+#define SAVE_STATE()           \
+  do {                         \
+    vm->ip = ip;               \
+    vm->stack_top = stack_top; \
+  } while (false)
+#define RUNTIME_ERROR(...)          \
+  do {                              \
+    SAVE_STATE();                   \
+    runtime_error(vm, __VA_ARGS__); \
+    return INTERPRET_RUNTIME_ERROR; \
+  } while (false)
+// Quickens the instruction being run, which has no operands, into
+// `specialized`. Instructions are only quickened when both operands are
+// doubles or both are integers, so mixed operands stay generic.
+#define QUICKEN(specialized) (ip[-1] = (specialized))
+// Turns the instruction being run back into `generic`, and runs it again.
+// The profiler has already counted it, so it doesn't see it a second time.
+#define DEOPTIMIZE(generic) \
+  do {                      \
+    ip[-1] = (generic);     \
+    REDISPATCH(ip[-1]);     \
+  } while (false)
+// Two integers stay integers as long as the result fits. Checking for two
+// doubles first keeps floating point code as fast as it was before there
+// were integers.
+#define BINARY_OP(integer_op, op, integer_opcode, double_opcode)    \
+  do {                                                              \
+    Value r = PEEK(0);                                              \
+    Value l = PEEK(1);                                              \
+    int64_t result;                                                 \
+    if (IS_DOUBLE(l) && IS_DOUBLE(r)) {                             \
+      QUICKEN(double_opcode);                                       \
+      PEEK(1) = NUMBER_VALUE(AS_DOUBLE(l) op AS_DOUBLE(r));         \
+    } else if (IS_INTEGER(l) && IS_INTEGER(r) &&                    \
+               integer_op(AS_INTEGER(l), AS_INTEGER(r), &result)) { \
+      QUICKEN(integer_opcode);                                      \
+      PEEK(1) = INTEGER_VALUE(result);                              \
+    } else if (IS_NUMBER(l) && IS_NUMBER(r)) {                      \
+      PEEK(1) = NUMBER_VALUE(AS_NUMBER(l) op AS_NUMBER(r));         \
+    } else {                                                        \
+      RUNTIME_ERROR("operands must be numbers");                    \
+    }                                                               \
+    stack_top--;                                                    \
+  } while (false)
+// The quickened forms of BINARY_OP
+#define INTEGER_OP(integer_op, generic)                      \
+  do {                                                       \
+    int64_t result;                                          \
+    if (IS_INTEGER(PEEK(0)) && IS_INTEGER(PEEK(1)) &&        \
+        integer_op(AS_INTEGER(PEEK(1)), AS_INTEGER(PEEK(0)), \
+                   &result)) {                               \
+      stack_top--;                                           \
+      PEEK(0) = INTEGER_VALUE(result);                       \
+    } else {                                                 \
+      DEOPTIMIZE(generic);                                   \
+    }                                                        \
+  } while (false)
+#define DOUBLE_OP(op, generic)                         \
+  do {                                                 \
+    if (IS_DOUBLE(PEEK(0)) && IS_DOUBLE(PEEK(1))) {    \
+      double r = AS_DOUBLE(POP());                     \
+      PEEK(0) = NUMBER_VALUE(AS_DOUBLE(PEEK(0)) op r); \
+    } else {                                           \
+      DEOPTIMIZE(generic);                             \
+    }                                                  \
+  } while (false)
+
+// The superinstructions that apply `op` to the value on the stack and a
+// constant. The compiler only fuses number constants, so the only operand
+// that can be the wrong type is the one on the stack.
+#define CONSTANT_OP(integer_op, op, message)                        \
+  do {                                                              \
+    Value r = READ_CONSTANT();                                      \
+    Value l = PEEK(0);                                              \
+    int64_t result;                                                 \
+    if (IS_DOUBLE(l) && IS_DOUBLE(r)) {                             \
+      PEEK(0) = NUMBER_VALUE(AS_DOUBLE(l) op AS_DOUBLE(r));         \
+    } else if (IS_INTEGER(l) && IS_INTEGER(r) &&                    \
+               integer_op(AS_INTEGER(l), AS_INTEGER(r), &result)) { \
+      PEEK(0) = INTEGER_VALUE(result);                              \
+    } else if (IS_NUMBER(l)) {                                      \
+      PEEK(0) = NUMBER_VALUE(AS_NUMBER(l) op AS_NUMBER(r));         \
+    } else {                                                        \
+      RUNTIME_ERROR(message);                                       \
+    }                                                               \
   } while (false)
 
-  for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-    printf("\t");
-    for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
-      printf("[ ");
-      value_print(*slot);
-      printf(" ]");
+#define TRACE_INSTRUCTION()                                             \
+  do {                                                                  \
+    output_flush(&vm->output);                                          \
+    printf("\t");                                                       \
+    for (Value* trace_slot = vm->stack; trace_slot < stack_top;         \
+         trace_slot++) {                                                \
+      printf("[ ");                                                     \
+      value_print(*trace_slot);                                         \
+      printf(" ]");                                                     \
+    }                                                                   \
+    printf("\n");                                                       \
+    disassemble_instruction(vm->chunk, (size_t)(ip - vm->chunk->code)); \
+  } while (false)
+#else
+#define TRACE_INSTRUCTION() \
+  do {                      \
+  } while (false)
+#endif
+
+#ifdef THREADED_DISPATCH
+  // Each handler ends with its own indirect jump to the next handler, which
+  // gives the branch predictor one history slot per opcode.
+  static void* dispatch_table[] = {
+      [OP_CONSTANT] = &&op_constant,
+      [OP_CONSTANT_LONG] = &&op_constant_long,
+      [OP_NIL] = &&op_nil,
+      [OP_TRUE] = &&op_true,
+      [OP_FALSE] = &&op_false,
+      [OP_POP] = &&op_pop,
+      [OP_GET_GLOBAL] = &&op_get_global,
+      [OP_DEFINE_GLOBAL] = &&op_define_global,
+      [OP_SET_GLOBAL] = &&op_set_global,
+      [OP_NEGATE] = &&op_negate,
+      [OP_ADD] = &&op_add,
+      [OP_SUBTRACT] = &&op_subtract,
+      [OP_MULTIPLY] = &&op_multiply,
+      [OP_DIVIDE] = &&op_divide,
+      [OP_PRINT] = &&op_print,
+      [OP_RETURN] = &&op_return,
+      [OP_CONSTANT_ADD] = &&op_constant_add,
+      [OP_CONSTANT_SUBTRACT] = &&op_constant_subtract,
+      [OP_CONSTANT_MULTIPLY] = &&op_constant_multiply,
+      [OP_CONSTANT_DIVIDE] = &&op_constant_divide,
+      [OP_SET_GLOBAL_POP] = &&op_set_global_pop,
+      [OP_ADD_INT] = &&op_add_int,
+      [OP_ADD_NUM] = &&op_add_num,
+      [OP_SUBTRACT_INT] = &&op_subtract_int,
+      [OP_SUBTRACT_NUM] = &&op_subtract_num,
+      [OP_MULTIPLY_INT] = &&op_multiply_int,
+      [OP_MULTIPLY_NUM] = &&op_multiply_num,
+      [OP_DIVIDE_NUM] = &&op_divide_num,
+  };
+  // When profiling, every opcode goes through op_profile on its way to its
+  // handler, so unprofiled runs pay nothing
+  static void* profile_table[] = {
+      [0 ... OPCODE_COUNT - 1] = &&op_profile,
+  };
+  void** dispatch = vm->profile != NULL ? profile_table : dispatch_table;
+
+#define OPCODE(op, label) label
+#define DISPATCH()               \
+  do {                           \
+    TRACE_INSTRUCTION();         \
+    goto* dispatch[READ_BYTE()]; \
+  } while (false)
+// Jumps to the handler for `opcode`, bypassing op_profile
+#define REDISPATCH(opcode) goto* dispatch_table[(opcode)]
+
+  DISPATCH();
+
+op_profile:
+  profile_instruction(vm->profile, vm->chunk, ip - 1);
+  goto* dispatch_table[ip[-1]];
+#else
+#define OPCODE(op, label) case op
+#define DISPATCH() break
+#define REDISPATCH(opcode)  \
+  do {                      \
+    instruction = (opcode); \
+    goto redispatch;        \
+  } while (false)
+
+  Profile* profile = vm->profile;
+  for (;;) {
+    TRACE_INSTRUCTION();
+    if (profile != NULL) {
+      profile_instruction(profile, vm->chunk, ip);
     }
-    printf("\n");
-    disassemble_instruction(vm.chunk, (size_t)(vm.ip - vm.chunk->code));
+    uint8_t instruction = READ_BYTE();
+  redispatch:
+    switch (instruction) {
 #endif
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-      case OP_CONSTANT: {
-        Value value = READ_CONSTANT();
-        push(value);
-        break;
+  OPCODE(OP_CONSTANT, op_constant) : {
+    Value value = READ_CONSTANT();
+    PUSH(value);
+    DISPATCH();
+  }
+  OPCODE(OP_CONSTANT_LONG, op_constant_long) : {
+    Value value = READ_CONSTANT_LONG();
+    PUSH(value);
+    DISPATCH();
+  }
+  OPCODE(OP_NIL, op_nil) : {
+    PUSH(NIL_VALUE());
+    DISPATCH();
+  }
+  OPCODE(OP_TRUE, op_true) : {
+    PUSH(BOOL_VALUE(true));
+    DISPATCH();
+  }
+  OPCODE(OP_FALSE, op_false) : {
+    PUSH(BOOL_VALUE(false));
+    DISPATCH();
+  }
+  OPCODE(OP_POP, op_pop) : {
+    stack_top--;
+    DISPATCH();
+  }
+  OPCODE(OP_GET_GLOBAL, op_get_global) : {
+    size_t slot = READ_SHORT();
+    Value value = globals[slot];
+    if (IS_UNDEFINED(value)) {
+      RUNTIME_ERROR("undefined variable '%s'", vm->globals.names[slot]->chars);
+    }
+    PUSH(value);
+    DISPATCH();
+  }
+  OPCODE(OP_DEFINE_GLOBAL, op_define_global) : {
+    Value value = POP();
+    GC_BARRIER(vm, value);
+    globals[READ_SHORT()] = value;
+    DISPATCH();
+  }
+  OPCODE(OP_SET_GLOBAL, op_set_global) : {
+    size_t slot = READ_SHORT();
+    if (IS_UNDEFINED(globals[slot])) {
+      RUNTIME_ERROR("undefined variable '%s'", vm->globals.names[slot]->chars);
+    }
+    GC_BARRIER(vm, PEEK(0));
+    globals[slot] = PEEK(0);
+    DISPATCH();
+  }
+  OPCODE(OP_NEGATE, op_negate) : {
+    if (!IS_NUMBER(PEEK(0))) {
+      RUNTIME_ERROR("operand must be a number");
+    }
+    Value value = PEEK(0);
+    // -0 has to be a double
+    if (IS_INTEGER(value) && AS_INTEGER(value) != 0 &&
+        -AS_INTEGER(value) <= INTEGER_MAX) {
+      PEEK(0) = INTEGER_VALUE(-AS_INTEGER(value));
+    } else {
+      PEEK(0) = NUMBER_VALUE(-AS_NUMBER(value));
+    }
+    DISPATCH();
+  }
+  OPCODE(OP_ADD, op_add) : {
+    int64_t sum;
+    if (IS_DOUBLE(PEEK(0)) && IS_DOUBLE(PEEK(1))) {
+      QUICKEN(OP_ADD_NUM);
+      double r = AS_DOUBLE(POP());
+      double l = AS_DOUBLE(POP());
+      PUSH(NUMBER_VALUE(l + r));
+    } else if (IS_INTEGER(PEEK(0)) && IS_INTEGER(PEEK(1)) &&
+               integer_add(AS_INTEGER(PEEK(1)), AS_INTEGER(PEEK(0)), &sum)) {
+      QUICKEN(OP_ADD_INT);
+      stack_top--;
+      PEEK(0) = INTEGER_VALUE(sum);
+    } else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+      double r = AS_NUMBER(POP());
+      double l = AS_NUMBER(POP());
+      PUSH(NUMBER_VALUE(l + r));
+    } else if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+      // The collector may run, and the operands must stay on the stack
+      // where it can see them
+      vm->stack_top = stack_top;
+      ObjString* result =
+          string_concatenate(vm, AS_STRING(PEEK(1)), AS_STRING(PEEK(0)));
+      if (result == NULL) {
+        RUNTIME_ERROR("out of memory");
       }
-      case OP_NIL:
-        push(NIL_VALUE());
-        break;
-      case OP_TRUE:
-        push(BOOL_VALUE(true));
-        break;
-      case OP_FALSE:
-        push(BOOL_VALUE(false));
-        break;
-      case OP_NEGATE:
-        if (!IS_NUMBER(peek(0))) {
-          runtime_error("operand must be a number");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(NUMBER_VALUE(-AS_NUMBER(pop())));
-        break;
-      case OP_ADD:
-        BINARY_OP(NUMBER_VALUE, +);
-        break;
-      case OP_SUBTRACT:
-        BINARY_OP(NUMBER_VALUE, -);
-        break;
-      case OP_MULTIPLY:
-        BINARY_OP(NUMBER_VALUE, *);
-        break;
-      case OP_DIVIDE:
-        BINARY_OP(NUMBER_VALUE, /);
-        break;
-      case OP_RETURN:
-        value_print(pop());
-        printf("\n");
-        return INTERPRET_OK;
+      stack_top -= 2;
+      PUSH(OBJ_VALUE(result));
+    } else {
+      RUNTIME_ERROR("operands must be two numbers or two strings");
     }
+    DISPATCH();
+  }
+  OPCODE(OP_SUBTRACT, op_subtract) : {
+    BINARY_OP(integer_subtract, -, OP_SUBTRACT_INT, OP_SUBTRACT_NUM);
+    DISPATCH();
+  }
+  OPCODE(OP_MULTIPLY, op_multiply) : {
+    BINARY_OP(integer_multiply, *, OP_MULTIPLY_INT, OP_MULTIPLY_NUM);
+    DISPATCH();
+  }
+  OPCODE(OP_DIVIDE, op_divide) : {
+    // Quotients are seldom integers, so division always uses doubles
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+      RUNTIME_ERROR("operands must be numbers");
+    }
+    if (IS_DOUBLE(PEEK(0)) && IS_DOUBLE(PEEK(1))) {
+      QUICKEN(OP_DIVIDE_NUM);
+    }
+    double r = AS_NUMBER(POP());
+    double l = AS_NUMBER(POP());
+    PUSH(NUMBER_VALUE(l / r));
+    DISPATCH();
+  }
+  OPCODE(OP_PRINT, op_print) : {
+    value_write(&vm->output, POP());
+    output_char(&vm->output, '\n');
+    DISPATCH();
   }
+  OPCODE(OP_RETURN, op_return) : {
+    SAVE_STATE();
+    return INTERPRET_OK;
+  }
+  OPCODE(OP_CONSTANT_ADD, op_constant_add) : {
+    CONSTANT_OP(integer_add, +, "operands must be two numbers or two strings");
+    DISPATCH();
+  }
+  OPCODE(OP_CONSTANT_SUBTRACT, op_constant_subtract) : {
+    CONSTANT_OP(integer_subtract, -, "operands must be numbers");
+    DISPATCH();
+  }
+  OPCODE(OP_CONSTANT_MULTIPLY, op_constant_multiply) : {
+    CONSTANT_OP(integer_multiply, *, "operands must be numbers");
+    DISPATCH();
+  }
+  OPCODE(OP_CONSTANT_DIVIDE, op_constant_divide) : {
+    if (!IS_NUMBER(PEEK(0))) {
+      RUNTIME_ERROR("operands must be numbers");
+    }
+    double r = AS_NUMBER(READ_CONSTANT());
+    PEEK(0) = NUMBER_VALUE(AS_NUMBER(PEEK(0)) / r);
+    DISPATCH();
+  }
+  OPCODE(OP_SET_GLOBAL_POP, op_set_global_pop) : {
+    size_t slot = READ_SHORT();
+    if (IS_UNDEFINED(globals[slot])) {
+      RUNTIME_ERROR("undefined variable '%s'", vm->globals.names[slot]->chars);
+    }
+    Value value = POP();
+    GC_BARRIER(vm, value);
+    globals[slot] = value;
+    DISPATCH();
+  }
+  OPCODE(OP_ADD_INT, op_add_int) : {
+    INTEGER_OP(integer_add, OP_ADD);
+    DISPATCH();
+  }
+  OPCODE(OP_ADD_NUM, op_add_num) : {
+    DOUBLE_OP(+, OP_ADD);
+    DISPATCH();
+  }
+  OPCODE(OP_SUBTRACT_INT, op_subtract_int) : {
+    INTEGER_OP(integer_subtract, OP_SUBTRACT);
+    DISPATCH();
+  }
+  OPCODE(OP_SUBTRACT_NUM, op_subtract_num) : {
+    DOUBLE_OP(-, OP_SUBTRACT);
+    DISPATCH();
+  }
+  OPCODE(OP_MULTIPLY_INT, op_multiply_int) : {
+    INTEGER_OP(integer_multiply, OP_MULTIPLY);
+    DISPATCH();
+  }
+  OPCODE(OP_MULTIPLY_NUM, op_multiply_num) : {
+    DOUBLE_OP(*, OP_MULTIPLY);
+    DISPATCH();
+  }
+  OPCODE(OP_DIVIDE_NUM, op_divide_num) : {
+    DOUBLE_OP(/, OP_DIVIDE);
+    DISPATCH();
+  }
+#ifndef THREADED_DISPATCH
+    }
+  }
+#endif
 
+#undef REDISPATCH
+#undef DISPATCH
+#undef OPCODE
+#undef TRACE_INSTRUCTION
+#undef CONSTANT_OP
+#undef DOUBLE_OP
+#undef INTEGER_OP
 #undef BINARY_OP
+#undef DEOPTIMIZE
+#undef QUICKEN
+#undef RUNTIME_ERROR
+#undef SAVE_STATE
+#undef PEEK
+#undef POP
+#undef PUSH
+#undef READ_CONSTANT_LONG
 #undef READ_CONSTANT
+#undef READ_SHORT
 #undef READ_BYTE
 }
 
-InterpretResult interpret(const char* source) {
-  Chunk chunk;
-  chunk_init(&chunk);
+InterpretResult interpret_chunk(VM* vm, Chunk* chunk) {
+  Chunk* enclosing = vm->chunk;
+  vm->chunk = chunk;
+  vm->ip = chunk->code;
 
-  if (!compile(source, &chunk)) {
-    chunk_free(&chunk);
-    return INTERPRET_COMPILE_ERROR;
+  // The compiler knows how deep the chunk takes the stack, so its size is
+  // checked once here rather than on every push in run()
+  if (!reserve_stack(vm, chunk->max_stack)) {
+    size_t depth = (size_t)(vm->stack_top - vm->stack);
+    if (depth + chunk->max_stack > vm->stack_limit) {
+      runtime_error(vm, "stack overflow (needs %lu slots, limit is %lu)",
+                    depth + chunk->max_stack, vm->stack_limit);
+    } else {
+      runtime_error(vm, "out of memory");
+    }
+    vm->chunk = enclosing;
+    return INTERPRET_RUNTIME_ERROR;
   }
 
-  vm.chunk = &chunk;
-  vm.ip = chunk.code;
+  if (vm->profile != NULL) {
+    profile_outside(vm->profile);
+  }
+  uint64_t start = clock_nanoseconds();
+  InterpretResult result = run(vm);
+  vm->run_time += clock_nanoseconds() - start;
+  output_flush(&vm->output);
+  vm->chunk = enclosing;
+  return result;
+}
+
+InterpretResult interpret(VM* vm, const char* source) {
+  // Everything the compiler allocates lives in an arena that is released in
+  // one go once the chunk has run
+  Arena arena;
+  arena_init(&arena, vm->allocator);
+
+  Chunk chunk;
+  chunk_init(&chunk, &arena.allocator);
+
+  uint64_t start = clock_nanoseconds();
+  bool compiled = compile(vm, source, &chunk);
+  vm->compile_time += clock_nanoseconds() - start;
 
-  run();
+  InterpretResult result =
+      compiled ? interpret_chunk(vm, &chunk) : INTERPRET_COMPILE_ERROR;
 
   chunk_free(&chunk);
-  return INTERPRET_OK;
+  arena_free(&arena);
+  return result;
 }
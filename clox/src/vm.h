@@ -2,14 +2,57 @@
 #define clox_vm_h
 
 #include "chunk.h"
+#include "gc.h"
+#include "output.h"
+#include "profile.h"
+#include "table.h"
 
-#define STACK_MAX 256
+// The stack starts at STACK_MIN slots and grows on demand, up to the VM's
+// stack_limit, which defaults to STACK_LIMIT_DEFAULT.
+//
+// The limit can be changed after vm_init(), before the VM is used.
+#define STACK_MIN 64
+#define STACK_LIMIT_DEFAULT (1 << 20)
 
+// Global variables live in a dense array of slots. The compiler resolves
+// each name to its slot once, so running code never looks names up. A slot
+// holds UNDEFINED_VALUE() until its variable's definition has run, which
+// lets code refer to globals that a later chunk defines.
 typedef struct {
+  // Name -> slot index, stored as a number
+  Table slots;
+  // Slot index -> name, for error messages
+  ObjString** names;
+  Value* values;
+  size_t count;
+  size_t capacity;
+} Globals;
+
+typedef struct VM {
+  // Everything the VM allocates goes through here. It is the collector's
+  // wrapper around the allocator passed to vm_init().
+  Allocator* allocator;
+  // The chunk being compiled, loaded or run. Its constants are GC roots.
   Chunk* chunk;
   uint8_t* ip;
-  Value stack[STACK_MAX];
+  Value* stack;
   Value* stack_top;
+  size_t stack_capacity;
+  size_t stack_limit;
+  // Interned strings. Keys are the strings, values are unused.
+  Table strings;
+  Globals globals;
+  // Every object the VM has allocated
+  Obj* objects;
+  GC gc;
+  // What the script prints. It goes to stdout unless the embedder points
+  // output.stream somewhere else after vm_init().
+  Output output;
+  // Attached by the embedder to profile run(), or NULL
+  Profile* profile;
+  // Time spent in the compiler and in run(), in nanoseconds
+  uint64_t compile_time;
+  uint64_t run_time;
 } VM;
 
 typedef enum {
@@ -18,10 +61,19 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
-void vm_init(void);
-void vm_free(void);
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop(void);
+// A VM holds all the state of a running script. Separate VMs share nothing,
+// and can run on different threads at the same time.
+void vm_init(VM* vm, Allocator* allocator);
+void vm_free(VM* vm);
+InterpretResult interpret(VM* vm, const char* source);
+InterpretResult interpret_chunk(VM* vm, Chunk* chunk);
+// Returns the slot of the global variable called `name`, adding an
+// undefined one if there is none yet. Returns SIZE_MAX if memory runs out.
+size_t vm_global_slot(VM* vm, ObjString* name);
+bool push(VM* vm, Value value);
+Value pop(VM* vm);
+
+// Monotonic clock, in nanoseconds
+uint64_t clock_nanoseconds(void);
 
 #endif
@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "check.h"
+#include "compiler.h"
+#include "object.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+// Offsets into the file, which follow its private header layout
+#define CODE_COUNT_OFFSET 16
+#define MAX_STACK_OFFSET 48
+#define CODE_OFFSET 56
+
+// Compiles to OP_CONSTANT 0 ('six'), OP_DEFINE_GLOBAL 0 0, OP_CONSTANT 1,
+// OP_DEFINE_GLOBAL 1 0, OP_GET_GLOBAL 1 0, OP_CONSTANT_MULTIPLY 2,
+// OP_CONSTANT_ADD 3, OP_DEFINE_GLOBAL 2 0, OP_RETURN
+static const char* SOURCE =
+    "var s = \"six\"; var x = 6; var z = x * 7 + 0.5;";
+
+#define PATH_TEMPLATE "/tmp/clox_cache_XXXXXX"
+
+static char path[sizeof(PATH_TEMPLATE)];
+
+static void cache_setup(void) {
+  setup_dmalloc();
+  strcpy(path, PATH_TEMPLATE);
+  int fd = mkstemp(path);
+  ck_assert_int_ne(fd, -1);
+  close(fd);
+}
+
+static void cache_teardown(void) {
+  remove(path);
+  teardown_dmalloc();
+}
+
+static uint64_t source_hash(void) {
+  return cache_hash_source(SOURCE, strlen(SOURCE));
+}
+
+static void write_cache(void) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, SOURCE, &chunk));
+  ck_assert(cache_write(&vm, &chunk, source_hash(), path));
+  chunk_free(&chunk);
+  vm_free(&vm);
+}
+
+static void write_bytes(long offset, const void* bytes, size_t size) {
+  FILE* f = fopen(path, "r+b");
+  ck_assert_ptr_nonnull(f);
+  ck_assert_int_eq(fseek(f, offset, SEEK_SET), 0);
+  ck_assert_uint_eq(fwrite(bytes, 1, size, f), size);
+  fclose(f);
+}
+
+static void write_byte(long offset, uint8_t byte) {
+  write_bytes(offset, &byte, 1);
+}
+
+static uint64_t read_code_count(void) {
+  FILE* f = fopen(path, "rb");
+  ck_assert_ptr_nonnull(f);
+  uint64_t count;
+  ck_assert_int_eq(fseek(f, CODE_COUNT_OFFSET, SEEK_SET), 0);
+  ck_assert_uint_eq(fread(&count, sizeof(count), 1, f), 1);
+  fclose(f);
+  return count;
+}
+
+static bool loads(uint64_t hash) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  CacheMapping mapping;
+  bool loaded = cache_load(&vm, path, hash, &chunk, &mapping);
+  if (loaded) {
+    cache_unload(&chunk, &mapping);
+  }
+  vm_free(&vm);
+  return loaded;
+}
+
+static Value global(VM* vm, const char* name) {
+  ObjString* string = string_copy(vm, name, strlen(name));
+  return vm->globals.values[vm_global_slot(vm, string)];
+}
+
+START_TEST(test_round_trip) {
+  write_cache();
+  // The stored stack depth isn't trusted, and is recomputed
+  uint64_t max_stack = 0;
+  write_bytes(MAX_STACK_OFFSET, &max_stack, sizeof(max_stack));
+
+  // A VM that numbers the globals differently from the compiling one
+  VM vm;
+  vm_init(&vm, system_allocator());
+  ck_assert_int_eq(interpret(&vm, "var other = 1; var z = 0;"), INTERPRET_OK);
+
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  CacheMapping mapping;
+  ck_assert(cache_load(&vm, path, source_hash(), &chunk, &mapping));
+  ck_assert_uint_eq(chunk.max_stack, 1);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  cache_unload(&chunk, &mapping);
+
+  ck_assert(AS_NUMBER(global(&vm, "z")) == 42.5);
+  ck_assert(AS_NUMBER(global(&vm, "other")) == 1);
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_stale) {
+  write_cache();
+  ck_assert(loads(source_hash()));
+  ck_assert(!loads(source_hash() + 1));
+
+  remove(path);
+  ck_assert(!loads(source_hash()));
+}
+END_TEST
+
+START_TEST(test_truncated) {
+  write_cache();
+  FILE* f = fopen(path, "rb");
+  ck_assert_ptr_nonnull(f);
+  ck_assert_int_eq(fseek(f, 0, SEEK_END), 0);
+  long size = ftell(f);
+  fclose(f);
+
+  long sizes[] = {size - 1, CODE_OFFSET + 3, CODE_OFFSET, 10, 0};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    ck_assert_int_eq(truncate(path, sizes[i]), 0);
+    ck_assert(!loads(source_hash()));
+  }
+}
+END_TEST
+
+START_TEST(test_corrupted) {
+  write_cache();
+  long last = CODE_OFFSET + (long)read_code_count() - 1;
+
+  struct {
+    long offset;
+    uint8_t byte;
+  } corruptions[] = {
+      // Unknown opcode
+      {CODE_OFFSET, OPCODE_COUNT},
+      {CODE_OFFSET, 0xff},
+      // Constant and global slot operands past the end of their tables
+      {CODE_OFFSET + 1, 0xff},
+      {CODE_OFFSET + 4, 0xff},
+      // A superinstruction's constant that isn't a number
+      {CODE_OFFSET + 14, 0},
+      // Pops an empty stack
+      {CODE_OFFSET, OP_POP},
+      // An operand running past the end of the code
+      {last, OP_CONSTANT_LONG},
+      // Doesn't end in OP_RETURN
+      {last, OP_NIL},
+  };
+  for (size_t i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); i++) {
+    write_cache();
+    write_byte(corruptions[i].offset, corruptions[i].byte);
+    ck_assert_msg(!loads(source_hash()), "corruption %zu loaded", i);
+  }
+
+  // No code at all
+  write_cache();
+  uint64_t code_count = 0;
+  write_bytes(CODE_COUNT_OFFSET, &code_count, sizeof(code_count));
+  ck_assert(!loads(source_hash()));
+}
+END_TEST
+
+Suite* cache_suite(void) {
+  Suite* s = suite_create("cache");
+
+  TCase* tc = tcase_create("files");
+  tcase_add_checked_fixture(tc, cache_setup, cache_teardown);
+  tcase_add_test(tc, test_round_trip);
+  tcase_add_test(tc, test_stale);
+  tcase_add_test(tc, test_truncated);
+  tcase_add_test(tc, test_corrupted);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "gc.h"
+#include "object.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+static size_t count_objects(VM* vm) {
+  size_t count = 0;
+  for (Obj* object = vm->objects; object != NULL; object = object->next) {
+    count++;
+  }
+  return count;
+}
+
+static Value global(VM* vm, const char* name) {
+  ObjString* string = string_copy(vm, name, strlen(name));
+  return vm->globals.values[vm_global_slot(vm, string)];
+}
+
+// Gives the collector enough globals that marking takes several slices
+static void define_globals(VM* vm, int count) {
+  char source[64];
+  for (int i = 0; i < count; i++) {
+    snprintf(source, sizeof(source), "var g%d = \"%d\" + \"!\";", i, i);
+    ck_assert_int_eq(interpret(vm, source), INTERPRET_OK);
+  }
+}
+
+START_TEST(test_collect) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ck_assert_int_eq(interpret(&vm, "var s = \"a\"; s = s + \"b\" + \"c\";"
+                                  "var t = s + \"d\"; s = nil;"),
+                   INTERPRET_OK);
+  // "a", "b", "c", "ab", "abc", "d" and "abcd", plus the names
+  ck_assert_uint_eq(count_objects(&vm), 9);
+  size_t before = vm.gc.bytes_allocated;
+
+  gc_collect(&vm);
+  ck_assert_int_eq(vm.gc.state, GC_IDLE);
+  ck_assert_uint_eq(vm.gc.stats.cycles, 1);
+  ck_assert_uint_eq(vm.gc.stats.objects_freed, 6);
+  ck_assert_uint_eq(count_objects(&vm), 3);
+  ck_assert_uint_lt(vm.gc.bytes_allocated, before);
+  ck_assert_str_eq(AS_CSTRING(global(&vm, "t")), "abcd");
+
+  // Freed strings are gone from the intern table, and can be made again
+  ck_assert_uint_eq(vm.strings.count, 3);
+  ck_assert_int_eq(interpret(&vm, "s = \"ab\" + \"c\";"), INTERPRET_OK);
+  ck_assert_str_eq(AS_CSTRING(global(&vm, "s")), "abc");
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_global_barrier) {
+  // Moving the only reference to a string into a global that has already
+  // been scanned must keep the string alive
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  define_globals(&vm, 200);
+
+  // One slice scans g0 but not g199
+  vm.gc.pause_target = 0;
+  gc_step(&vm);
+  ck_assert_int_eq(vm.gc.state, GC_MARK);
+  ck_assert_uint_gt(vm.gc.global_cursor, 1);
+  ck_assert_uint_lt(vm.gc.global_cursor, 199);
+
+  ck_assert_int_eq(interpret(&vm, "g0 = g199; g199 = nil;"), INTERPRET_OK);
+  gc_collect(&vm);
+  ck_assert_str_eq(AS_CSTRING(global(&vm, "g0")), "199!");
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_intern_barrier) {
+  // A string that is only interned when marking starts is garbage, unless
+  // code compiled during marking looks it up again
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  define_globals(&vm, 200);
+  ck_assert_int_eq(interpret(&vm, "\"ab\" + \"cd\";"), INTERPRET_OK);
+  vm.gc.pause_target = 0;
+  gc_step(&vm);
+  ck_assert_int_eq(vm.gc.state, GC_MARK);
+
+  ck_assert_int_eq(interpret(&vm, "var x = \"abcd\";"), INTERPRET_OK);
+  gc_collect(&vm);
+  ck_assert_str_eq(AS_CSTRING(global(&vm, "x")), "abcd");
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_intern_sweep) {
+  // The sweep drops strings from the intern table as it frees them, so one
+  // it hasn't reached yet can still be looked up, and must then survive
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ck_assert_int_eq(interpret(&vm, "\"ab\" + \"cd\";"), INTERPRET_OK);
+  // Newer objects are swept first, so the globals hold the sweep back
+  define_globals(&vm, 200);
+  vm.gc.pause_target = 0;
+  do {
+    gc_step(&vm);
+  } while (vm.gc.state != GC_SWEEP);
+
+  ck_assert_int_eq(interpret(&vm, "var x = \"abcd\";"), INTERPRET_OK);
+  ck_assert_int_eq(vm.gc.state, GC_SWEEP);
+  gc_collect(&vm);
+  ck_assert_str_eq(AS_CSTRING(global(&vm, "x")), "abcd");
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_incremental) {
+  // Collections driven by allocation, one small step at a time, keep every
+  // live string intact and the heap bounded
+  VM vm;
+  vm_init(&vm, system_allocator());
+  vm.gc.pause_target = 0;
+
+  size_t count = 4000;
+  char* source = malloc(count * 32 + 64);
+  char* p = source;
+  p += sprintf(p, "var s = \"\"; var t = \"\";");
+  for (size_t i = 0; i < count; i++) {
+    p += sprintf(p, "s = s + \"%zu\"; t = \"%zu\" + \"x\";", i % 10, i);
+  }
+  ck_assert_int_eq(interpret(&vm, source), INTERPRET_OK);
+  free(source);
+
+  GCStats* stats = &vm.gc.stats;
+  ck_assert_uint_gt(stats->cycles, 1);
+  ck_assert_uint_gt(stats->steps, stats->cycles);
+  ck_assert_uint_lt(vm.gc.bytes_allocated, 4 * GC_HEAP_MIN);
+
+  ObjString* s = AS_STRING(global(&vm, "s"));
+  ck_assert_uint_eq(s->length, count);
+  for (size_t i = 0; i < count; i++) {
+    ck_assert_int_eq(s->chars[i], '0' + (int)(i % 10));
+  }
+  ck_assert_str_eq(AS_CSTRING(global(&vm, "t")), "3999x");
+
+  size_t pauses = 0;
+  for (size_t i = 0; i < GC_HISTOGRAM_BUCKETS; i++) {
+    pauses += stats->pauses[i];
+  }
+  ck_assert_uint_eq(pauses, stats->steps);
+  // The final scan of the roots is one of the pauses
+  ck_assert_uint_le(stats->max_final_mark, stats->max_pause);
+  ck_assert_uint_le(stats->total_final_mark, stats->total_pause);
+
+  vm_free(&vm);
+}
+END_TEST
+
+Suite* gc_suite(void) {
+  Suite* s = suite_create("gc");
+
+  TCase* tc = tcase_create("collector");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_collect);
+  tcase_add_test(tc, test_global_barrier);
+  tcase_add_test(tc, test_intern_barrier);
+  tcase_add_test(tc, test_intern_sweep);
+  tcase_add_test(tc, test_incremental);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
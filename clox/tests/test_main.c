@@ -1,6 +1,7 @@
 #include <stdlib.h>
 
 #include "check.h"
+#include "tests.h"
 
 #include "dmalloc.h"
 
@@ -9,8 +10,17 @@ int main(void) {
   Suite *s;
   SRunner *sr;
 
-  s = strlist_suite();
+  s = vm_suite();
   sr = srunner_create(s);
+  srunner_add_suite(sr, cache_suite());
+  srunner_add_suite(sr, gc_suite());
+  srunner_add_suite(sr, memory_suite());
+  srunner_add_suite(sr, number_suite());
+  srunner_add_suite(sr, object_suite());
+  srunner_add_suite(sr, output_suite());
+  srunner_add_suite(sr, profile_suite());
+  srunner_add_suite(sr, scanner_suite());
+  srunner_add_suite(sr, table_suite());
 
   srunner_run_all(sr, CK_NORMAL);
   number_failed = srunner_ntests_failed(sr);
@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "check.h"
+#include "memory.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+// Passes requests through to the system allocator until its budget of
+// allocations runs out, then fails every one after that.
+typedef struct {
+  Allocator allocator;
+  size_t budget;
+} FailingAllocator;
+
+static void* failing_reallocate(Allocator* self, void* pointer,
+                                size_t old_size, size_t new_size) {
+  FailingAllocator* failing = (FailingAllocator*)self;
+  if (new_size > old_size) {
+    if (failing->budget == 0) {
+      return NULL;
+    }
+    failing->budget--;
+  }
+  Allocator* system = system_allocator();
+  return system->reallocate(system, pointer, old_size, new_size);
+}
+
+static void failing_init(FailingAllocator* failing, size_t budget) {
+  failing->allocator.reallocate = failing_reallocate;
+  failing->allocator.stats = NULL;
+  failing->allocator.suballocator = false;
+  failing->budget = budget;
+}
+
+START_TEST(test_arena_grows_last_in_place) {
+  Arena arena;
+  arena_init(&arena, system_allocator());
+
+  uint8_t* a = reallocate(&arena.allocator, MEMORY_CODE, NULL, 0, 16);
+  memset(a, 'a', 16);
+  uint8_t* b = reallocate(&arena.allocator, MEMORY_CODE, a, 16, 64);
+  ck_assert_ptr_eq(a, b);
+
+  // Once something else has been allocated, growing copies
+  uint8_t* c = reallocate(&arena.allocator, MEMORY_CODE, NULL, 0, 8);
+  uint8_t* d = reallocate(&arena.allocator, MEMORY_CODE, b, 64, 128);
+  ck_assert_ptr_ne(d, b);
+  ck_assert_ptr_ne(d, c);
+  ck_assert_int_eq(d[0], 'a');
+  ck_assert_int_eq(d[15], 'a');
+
+  arena_free(&arena);
+}
+END_TEST
+
+START_TEST(test_arena_large_allocations) {
+  Arena arena;
+  arena_init(&arena, system_allocator());
+
+  size_t size = ARENA_BLOCK_SIZE;
+  uint8_t* pointer = NULL;
+  for (size_t i = 0; i < 5; i++) {
+    pointer =
+        reallocate(&arena.allocator, MEMORY_CODE, pointer, size, size * 2);
+    ck_assert_ptr_nonnull(pointer);
+    memset(pointer, 0, size * 2);
+    size *= 2;
+  }
+
+  arena_free(&arena);
+  ck_assert_ptr_null(arena.blocks);
+}
+END_TEST
+
+START_TEST(test_out_of_memory) {
+  // Every allocation the compiler and VM make can fail. None of the failures
+  // should crash or leak.
+  const char* sources[] = {
+      "print 1 + (2 * (3 - 4)) / -5;",
+      "var a = \"a\"; a = a + \"b\" + \"c\"; print a + \"ab\";",
+  };
+
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    FailingAllocator failing;
+    failing_init(&failing, SIZE_MAX);
+    VM vm;
+    vm_init(&vm, &failing.allocator);
+    ck_assert_int_eq(interpret(&vm, sources[i]), INTERPRET_OK);
+    vm_free(&vm);
+    size_t needed = SIZE_MAX - failing.budget;
+    ck_assert_uint_ne(needed, 0);
+
+    for (size_t budget = 0; budget < needed; budget++) {
+      failing_init(&failing, budget);
+      vm_init(&vm, &failing.allocator);
+      ck_assert_int_ne(interpret(&vm, sources[i]), INTERPRET_OK);
+      vm_free(&vm);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_stats) {
+  MemoryStats stats;
+  memorystats_init(&stats);
+  Allocator allocator;
+  system_allocator_init(&allocator, &stats);
+
+  VM vm;
+  vm_init(&vm, &allocator);
+  ck_assert_int_eq(interpret(&vm, "1 + 2;"), INTERPRET_OK);
+
+  // Only the stack outlives interpret()
+  for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+    if (i != MEMORY_STACK) {
+      ck_assert_uint_eq(stats.bytes[i], 0);
+    }
+  }
+  ck_assert_uint_eq(stats.bytes[MEMORY_STACK],
+                    vm.stack_capacity * sizeof(Value));
+  ck_assert_uint_eq(stats.total_bytes, stats.bytes[MEMORY_STACK]);
+  ck_assert_uint_ne(stats.peak_bytes[MEMORY_CODE], 0);
+  ck_assert_uint_ge(stats.peak_total_bytes, ARENA_BLOCK_SIZE);
+  ck_assert_uint_eq(stats.allocations, stats.frees + 1);
+
+  vm_free(&vm);
+  ck_assert_uint_eq(stats.total_bytes, 0);
+  ck_assert_uint_eq(stats.allocations, stats.frees);
+}
+END_TEST
+
+Suite* memory_suite(void) {
+  Suite* s = suite_create("memory");
+
+  TCase* tc = tcase_create("arena");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_arena_grows_last_in_place);
+  tcase_add_test(tc, test_arena_large_allocations);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("failure");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_out_of_memory);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("stats");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_stats);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
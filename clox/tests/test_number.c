@@ -0,0 +1,245 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "number.h"
+#include "tests.h"
+
+#include "dmalloc.h"
+
+#define RANDOM_DOUBLES 200000
+#define RANDOM_LITERALS 200000
+#define RANDOM_FORMATS 200000
+
+static uint64_t random_state;
+
+static uint64_t next_random(void) {
+  // xorshift64
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static void random_setup(void) {
+  setup_dmalloc();
+  random_state = UINT64_C(88172645463325252);
+}
+
+// Checks that `text` converts to exactly what strtod() gives
+static void expect_strtod(const char* text) {
+  double expected = strtod(text, NULL);
+  double actual = number_parse(text, strlen(text));
+  if (memcmp(&expected, &actual, sizeof(double)) != 0) {
+    ck_abort_msg("%s: got %.17g, expected %.17g", text, actual, expected);
+  }
+}
+
+// Writes `number` without an exponent, as a Lox literal, with the 17
+// significant digits that identify it
+static void write_literal(double number, char* out) {
+  char scientific[32];
+  snprintf(scientific, sizeof(scientific), "%.16e", number);
+  char digits[17];
+  int count = 0;
+  const char* c = scientific;
+  for (; *c != 'e'; c++) {
+    if (*c != '.') {
+      digits[count++] = *c;
+    }
+  }
+  // The point goes after this many digits
+  int point = atoi(c + 1) + 1;
+
+  if (point <= 0) {
+    *out++ = '0';
+    *out++ = '.';
+    for (int i = point; i < 0; i++) {
+      *out++ = '0';
+    }
+    point = count + 1;
+  }
+  for (int i = 0; i < count || i < point; i++) {
+    if (i == point) {
+      *out++ = '.';
+    }
+    *out++ = i < count ? digits[i] : '0';
+  }
+  *out = '\0';
+}
+
+START_TEST(test_round_trip) {
+  // Every finite positive double, spread over the whole exponent range
+  char literal[400];
+  for (int i = 0; i < RANDOM_DOUBLES; i++) {
+    uint64_t bits = next_random() >> 1;
+    if ((bits >> 52) == 0x7ff) {
+      continue;
+    }
+    double number;
+    memcpy(&number, &bits, sizeof(double));
+    write_literal(number, literal);
+    expect_strtod(literal);
+  }
+}
+END_TEST
+
+START_TEST(test_random_literals) {
+  // Up to 50 significant digits, so some literals take the slow path
+  char literal[64];
+  for (int i = 0; i < RANDOM_LITERALS; i++) {
+    int length = 0;
+    int integer_digits = (int)(next_random() % 25);
+    int fraction_digits = (int)(next_random() % 25);
+    literal[length++] = (char)('1' + next_random() % 9);
+    for (int j = 0; j < integer_digits; j++) {
+      literal[length++] = (char)('0' + next_random() % 10);
+    }
+    if (fraction_digits > 0) {
+      literal[length++] = '.';
+      for (int j = 0; j < fraction_digits; j++) {
+        literal[length++] = (char)('0' + next_random() % 10);
+      }
+    }
+    literal[length] = '\0';
+    expect_strtod(literal);
+  }
+}
+END_TEST
+
+START_TEST(test_hard_cases) {
+  const char* cases[] = {
+      "0",
+      "0.0",
+      "000.000",
+      "0.1",
+      "0.3",
+      "123.456",
+      // 2^53 + 1 rounds to even, and just past it rounds up
+      "9007199254740993",
+      "9007199254740993.0000000000000000000000000001",
+      // Halfway between 1 and the next double, and either side of it
+      "1.00000000000000011102230246251565404236316680908203125",
+      "1.00000000000000011102230246251565404236316680908203124",
+      "1.00000000000000011102230246251565404236316680908203126",
+      // Leading zeros and trailing zeros beyond 19 digits
+      "0.000000000000000000000000000001",
+      "100000000000000000000000000000000000000",
+      "12345678901234567890123456789000000000.000000000000",
+      // Smallest normal, and the smallest subnormal and half of it
+      "0.00000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "00000000000000000000000000000000000000000000022250738585072014",
+      "0.00000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "0000000004940656458412465441765687928682213723651",
+      "0.00000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000"
+      "00000000024703282292062327208828439643411068618252990130716238221",
+      // The largest double, and the smallest value that rounds to infinity
+      "17976931348623157081452742373170435679807056752584499659891747680315"
+      "72607800285387605895586327668781715404589535143824642343213268894641"
+      "82768467546703537516986049910576551282076245490090389328944075868508"
+      "45513394230458323690322294816580855933212334827479782620414472316873"
+      "8177180919299881250404026184124858368",
+      "17976931348623158079372897140530341507993413271003782693617377898044"
+      "49682927647509466490179775872070963302864166928879109465555478519404"
+      "02630657488671505820681908902000708383676273854845817711531764475730"
+      "27006985557136695962284291481986083493647529271907416844436551070434"
+      "2711559699508093042880177904174497792",
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    expect_strtod(cases[i]);
+  }
+}
+END_TEST
+
+START_TEST(test_length_bound) {
+  // Only the token's characters count, not whatever follows it
+  ck_assert(number_parse("1.5e3", 3) == 1.5);
+  ck_assert(number_parse("0x10", 1) == 0);
+  ck_assert(number_parse("12345", 2) == 12);
+  ck_assert(number_parse("2.50000000000000000000001", 4) == 2.5);
+}
+END_TEST
+
+// Checks that number_format() writes what printf("%g") does
+static void expect_printf(double number) {
+  char expected[NUMBER_FORMAT_SIZE];
+  char actual[NUMBER_FORMAT_SIZE];
+  snprintf(expected, sizeof(expected), "%g", number);
+  size_t length = number_format(number, actual);
+  ck_assert_uint_lt(length, NUMBER_FORMAT_SIZE);
+  actual[length] = '\0';
+  ck_assert_msg(strcmp(actual, expected) == 0, "%.17g: got %s, expected %s",
+                number, actual, expected);
+}
+
+START_TEST(test_format_random) {
+  for (int i = 0; i < RANDOM_FORMATS; i++) {
+    // Any bit pattern, including infinities and NaNs
+    uint64_t bits = next_random();
+    double number;
+    memcpy(&number, &bits, sizeof(double));
+    expect_printf(number);
+
+    // Numbers with a few decimal digits, like most scripts print
+    number = (double)(next_random() % 20000000) - 10000000;
+    for (int j = (int)(next_random() % 24); j > 0; j--) {
+      number /= 10;
+    }
+    expect_printf(number);
+    expect_printf(number * 1e12);
+  }
+}
+END_TEST
+
+START_TEST(test_format_edges) {
+  const double cases[] = {
+      0.0, -0.0, 1.0, -1.0, 999999.0, 1e6, -1e6,
+      // Where %g switches between fixed and scientific notation
+      0.0001, 0.000099999, 0.00009999996, 999999.4, 999999.5, 999999.6,
+      // Halfway between two six-digit numbers, which snprintf() decides
+      1234565.0, 1234575.0, 0.1234565, 123456.5,
+      // Rounding up to the next power of ten
+      9999995.0, 0.99999951, 9.9999999e20,
+      // Too large or small to scale exactly
+      1e300, -1e-300, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308,
+      0.1, 0.2 + 0.1, 1.0 / 3, 2.0 / 3, 3.14159265358979,
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    expect_printf(cases[i]);
+  }
+}
+END_TEST
+
+Suite* number_suite(void) {
+  Suite* s = suite_create("number");
+
+  TCase* tc = tcase_create("strtod");
+  tcase_add_checked_fixture(tc, random_setup, teardown_dmalloc);
+  tcase_set_timeout(tc, 30);
+  tcase_add_test(tc, test_round_trip);
+  tcase_add_test(tc, test_random_literals);
+  tcase_add_test(tc, test_hard_cases);
+  tcase_add_test(tc, test_length_bound);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("format");
+  tcase_add_checked_fixture(tc, random_setup, teardown_dmalloc);
+  tcase_add_test(tc, test_format_random);
+  tcase_add_test(tc, test_format_edges);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "check.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+START_TEST(test_interning) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ObjString* a = string_copy(&vm, "hello", 5);
+  ObjString* b = string_copy(&vm, "hello world", 5);
+  ck_assert_ptr_eq(a, b);
+  ck_assert_str_eq(a->chars, "hello");
+  ck_assert_ptr_ne(string_copy(&vm, "hell", 4), a);
+
+  // Literals in compiled code are the same objects
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, "\"hello\" + \"hello\";", &chunk));
+  ck_assert_uint_eq(chunk.constants.count, 1);
+  ck_assert_ptr_eq(AS_OBJ(chunk.constants.values[0]), a);
+  chunk_free(&chunk);
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_concatenation) {
+  MemoryStats stats;
+  memorystats_init(&stats);
+  Allocator allocator;
+  system_allocator_init(&allocator, &stats);
+
+  VM vm;
+  vm_init(&vm, &allocator);
+  ObjString* foo = string_copy(&vm, "foo", 3);
+  ObjString* bar = string_copy(&vm, "bar", 3);
+
+  // A new string takes exactly one allocation, its own
+  size_t allocations = stats.allocations;
+  size_t bytes = stats.bytes[MEMORY_OBJECTS];
+  ObjString* foobar = string_concatenate(&vm, foo, bar);
+  ck_assert_str_eq(foobar->chars, "foobar");
+  ck_assert_uint_eq(foobar->length, 6);
+  ck_assert_uint_eq(stats.allocations, allocations + 1);
+  ck_assert_uint_eq(stats.bytes[MEMORY_OBJECTS],
+                    bytes + sizeof(ObjString) + 7);
+
+  // Existing strings are found without allocating, with the same hash
+  allocations = stats.allocations;
+  ck_assert_ptr_eq(string_concatenate(&vm, foo, bar), foobar);
+  ck_assert_ptr_eq(string_copy(&vm, "foobar", 6), foobar);
+  ck_assert_uint_eq(stats.allocations, allocations);
+
+  ObjString* empty = string_copy(&vm, "", 0);
+  ck_assert_ptr_eq(string_concatenate(&vm, empty, foo), foo);
+  ck_assert_ptr_eq(string_concatenate(&vm, foo, empty), foo);
+
+  vm_free(&vm);
+  ck_assert_uint_eq(stats.total_bytes, 0);
+}
+END_TEST
+
+START_TEST(test_many_strings) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ObjString* strings[1000];
+  char buffer[16];
+  for (int i = 0; i < 1000; i++) {
+    int length = sprintf(buffer, "s%d", i);
+    strings[i] = string_copy(&vm, buffer, (size_t)length);
+  }
+  for (int i = 0; i < 1000; i++) {
+    int length = sprintf(buffer, "s%d", i);
+    ck_assert_ptr_eq(string_copy(&vm, buffer, (size_t)length), strings[i]);
+  }
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_string_operands) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  ck_assert_int_eq(interpret(&vm, "\"a\" + \"b\" + \"c\";"), INTERPRET_OK);
+  ck_assert_int_eq(interpret(&vm, "\"a\" + 1;"), INTERPRET_RUNTIME_ERROR);
+  ck_assert_int_eq(interpret(&vm, "-\"a\";"), INTERPRET_RUNTIME_ERROR);
+  ck_assert_int_eq(interpret(&vm, "\"a\" * \"b\";"), INTERPRET_RUNTIME_ERROR);
+  vm_free(&vm);
+}
+END_TEST
+
+Suite* object_suite(void) {
+  Suite* s = suite_create("object");
+
+  TCase* tc = tcase_create("strings");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_interning);
+  tcase_add_test(tc, test_concatenation);
+  tcase_add_test(tc, test_many_strings);
+  tcase_add_test(tc, test_string_operands);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
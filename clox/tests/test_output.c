@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "output.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+// Returns how many bytes have reached `f` so far, and reads them into
+// `buffer` (terminated) if it is big enough
+static size_t written(FILE* f, char* buffer, size_t size) {
+  long end = ftell(f);
+  ck_assert(end >= 0);
+  rewind(f);
+  size_t length = fread(buffer, 1, size - 1, f);
+  buffer[length] = '\0';
+  fseek(f, end, SEEK_SET);
+  return (size_t)end;
+}
+
+START_TEST(test_buffering) {
+  FILE* f = tmpfile();
+  ck_assert_ptr_nonnull(f);
+  Output output;
+  output_init(&output, f);
+  char buffer[64];
+
+  // Nothing reaches the stream until the buffer fills or is flushed
+  output_write(&output, "ab", 2);
+  output_char(&output, 'c');
+  output_number(&output, 1.5);
+  ck_assert_uint_eq(written(f, buffer, sizeof(buffer)), 0);
+  output_flush(&output);
+  ck_assert_uint_eq(written(f, buffer, sizeof(buffer)), 6);
+  ck_assert_str_eq(buffer, "abc1.5");
+
+  // One byte past capacity pushes out everything before it
+  for (size_t i = 0; i < OUTPUT_CAPACITY; i++) {
+    output_char(&output, 'x');
+  }
+  ck_assert_uint_eq(written(f, buffer, sizeof(buffer)), 6);
+  output_char(&output, 'y');
+  ck_assert_uint_eq(written(f, buffer, sizeof(buffer)), 6 + OUTPUT_CAPACITY);
+  ck_assert_uint_eq(output.length, 1);
+
+  // Writes too big to buffer go straight through, after what came first
+  static char big[OUTPUT_CAPACITY + 1];
+  memset(big, 'z', sizeof(big));
+  output_write(&output, big, sizeof(big));
+  ck_assert_uint_eq(output.length, 0);
+  ck_assert_uint_eq(written(f, buffer, sizeof(buffer)),
+                    6 + OUTPUT_CAPACITY + 1 + sizeof(big));
+
+  // Numbers never straddle a flush
+  output_write(&output, big, OUTPUT_CAPACITY - 3);
+  output_number(&output, -1.25e-10);
+  ck_assert_uint_eq(output.length, 9);
+  ck_assert_int_eq(memcmp(output.buffer, "-1.25e-10", 9), 0);
+
+  fclose(f);
+}
+END_TEST
+
+START_TEST(test_print) {
+  FILE* f = tmpfile();
+  ck_assert_ptr_nonnull(f);
+  VM vm;
+  vm_init(&vm, system_allocator());
+  vm.output.stream = f;
+  char buffer[256];
+
+  // Everything printed is out by the time interpret() returns
+  ck_assert_int_eq(interpret(&vm,
+                             "print 1; print -0.5; print 1 / 3; print 1000000;"
+                             "print nil; print true; print false;"
+                             "print \"a\" + \"b\";"),
+                   INTERPRET_OK);
+  written(f, buffer, sizeof(buffer));
+  ck_assert_str_eq(buffer, "1\n-0.5\n0.333333\n1e+06\nnil\ntrue\nfalse\nab\n");
+
+  // And so is everything printed before a runtime error
+  ck_assert_int_eq(interpret(&vm, "print 2; print -nil; print 3;"),
+                   INTERPRET_RUNTIME_ERROR);
+  written(f, buffer, sizeof(buffer));
+  ck_assert_str_eq(buffer,
+                   "1\n-0.5\n0.333333\n1e+06\nnil\ntrue\nfalse\nab\n2\n");
+
+  vm_free(&vm);
+  fclose(f);
+}
+END_TEST
+
+Suite* output_suite(void) {
+  Suite* s = suite_create("output");
+
+  TCase* tc = tcase_create("output");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_buffering);
+  tcase_add_test(tc, test_print);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
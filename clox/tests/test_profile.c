@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "compiler.h"
+#include "profile.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+START_TEST(test_instruction_counts) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  Profile profile;
+  profile_init(&profile, system_allocator());
+  vm.profile = &profile;
+
+  ck_assert_int_eq(interpret(&vm, "var a = 1; a = a + 2;"), INTERPRET_OK);
+  ck_assert_uint_eq(profile.instructions[OP_CONSTANT], 1);
+  ck_assert_uint_eq(profile.instructions[OP_DEFINE_GLOBAL], 1);
+  ck_assert_uint_eq(profile.instructions[OP_GET_GLOBAL], 1);
+  ck_assert_uint_eq(profile.instructions[OP_CONSTANT_ADD], 1);
+  ck_assert_uint_eq(profile.instructions[OP_SET_GLOBAL_POP], 1);
+  ck_assert_uint_eq(profile.instructions[OP_RETURN], 1);
+  ck_assert_uint_eq(profile.instructions[OP_PRINT], 0);
+
+  // Runs that stop at an error count what they executed
+  ck_assert_int_eq(interpret(&vm, "a = -nil;"), INTERPRET_RUNTIME_ERROR);
+  ck_assert_uint_eq(profile.instructions[OP_NIL], 1);
+  ck_assert_uint_eq(profile.instructions[OP_NEGATE], 1);
+  ck_assert_uint_eq(profile.instructions[OP_SET_GLOBAL_POP], 1);
+
+  vm_free(&vm);
+  profile_free(&profile);
+}
+END_TEST
+
+START_TEST(test_sequence_counts) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  Profile profile;
+  profile_init(&profile, system_allocator());
+  vm.profile = &profile;
+
+  // Sequences don't carry over from one run to the next
+  ck_assert_int_eq(interpret(&vm, "nil; nil;"), INTERPRET_OK);
+  ck_assert_int_eq(interpret(&vm, "true;"), INTERPRET_OK);
+  ck_assert_uint_eq(profile.pairs[OP_NIL][OP_POP], 2);
+  ck_assert_uint_eq(profile.pairs[OP_POP][OP_NIL], 1);
+  ck_assert_uint_eq(profile.pairs[OP_POP][OP_RETURN], 2);
+  ck_assert_uint_eq(profile.pairs[OP_RETURN][OP_TRUE], 0);
+  ck_assert_ptr_nonnull(profile.triples);
+  ck_assert_uint_eq(
+      profile.triples[opcode_sequence(OP_NIL, OP_POP, OP_NIL)], 1);
+  ck_assert_uint_eq(
+      profile.triples[opcode_sequence(OP_TRUE, OP_POP, OP_RETURN)], 1);
+  ck_assert_uint_eq(
+      profile.triples[opcode_sequence(OP_POP, OP_RETURN, OP_TRUE)], 0);
+
+  vm_free(&vm);
+  profile_free(&profile);
+}
+END_TEST
+
+START_TEST(test_deoptimized_counts) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  ck_assert_int_eq(interpret(&vm, "var x = 1; var y = 2; var z;"),
+                   INTERPRET_OK);
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, "z = x + y;", &chunk));
+  // Quickens the addition for integers
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  ck_assert_int_eq(interpret(&vm, "x = 1.5;"), INTERPRET_OK);
+
+  Profile profile;
+  profile_init(&profile, system_allocator());
+  vm.profile = &profile;
+
+  // The integer form fails its guard and hands over to the generic one,
+  // which is still the one instruction
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  ck_assert_uint_eq(profile.instructions[OP_ADD_INT], 1);
+  ck_assert_uint_eq(profile.instructions[OP_ADD], 0);
+  ck_assert_uint_eq(profile.pairs[OP_GET_GLOBAL][OP_ADD_INT], 1);
+  ck_assert_uint_eq(profile.pairs[OP_ADD_INT][OP_ADD], 0);
+  ck_assert_uint_eq(profile.pairs[OP_ADD_INT][OP_SET_GLOBAL_POP], 1);
+
+  chunk_free(&chunk);
+  vm_free(&vm);
+  profile_free(&profile);
+}
+END_TEST
+
+START_TEST(test_folded_output) {
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  chunk_write(&chunk, OP_NIL, 1);
+  chunk_write(&chunk, OP_NIL, 2);
+  chunk_write(&chunk, OP_NEGATE, 2);
+  chunk_write(&chunk, OP_RETURN, 3);
+
+  Profile profile;
+  profile_init(&profile, system_allocator());
+  profile.ticks = 2;
+  profile_sample(&profile, &chunk, &chunk.code[2]);
+  profile.ticks = 1;
+  profile_sample(&profile, &chunk, &chunk.code[0]);
+  profile.ticks = 3;
+  profile_sample(&profile, &chunk, &chunk.code[1]);
+  profile.ticks = 1;
+  profile_sample(&profile, &chunk, &chunk.code[2]);
+  profile.ticks = 4;
+  profile_outside(&profile);
+
+  // Merged by line and opcode, in line order
+  FILE* f = tmpfile();
+  ck_assert_ptr_nonnull(f);
+  profile_write_folded(&profile, f);
+  rewind(f);
+  char buffer[256];
+  size_t length = fread(buffer, 1, sizeof(buffer) - 1, f);
+  buffer[length] = '\0';
+  fclose(f);
+  ck_assert_str_eq(buffer,
+                   "script;line 1;OP_NIL 1\n"
+                   "script;line 2;OP_NIL 3\n"
+                   "script;line 2;OP_NEGATE 3\n"
+                   "outside 4\n");
+
+  profile_free(&profile);
+  chunk_free(&chunk);
+}
+END_TEST
+
+START_TEST(test_allocator) {
+  MemoryStats stats;
+  memorystats_init(&stats);
+  Allocator allocator;
+  system_allocator_init(&allocator, &stats);
+  VM vm;
+  vm_init(&vm, &allocator);
+  Profile profile;
+  profile_init(&profile, vm.allocator);
+  vm.profile = &profile;
+
+  ck_assert_int_eq(interpret(&vm, "nil; nil;"), INTERPRET_OK);
+  ck_assert_ptr_nonnull(profile.triples);
+  ck_assert_uint_ge(stats.bytes[MEMORY_PROFILE],
+                    (size_t)OPCODE_COUNT * OPCODE_COUNT * OPCODE_COUNT *
+                        sizeof(uint64_t));
+
+  profile_free(&profile);
+  ck_assert_uint_eq(stats.bytes[MEMORY_PROFILE], 0);
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_separate_timers) {
+  // Each running profile counts its own ticks
+  Profile a;
+  Profile b;
+  profile_init(&a, system_allocator());
+  profile_init(&b, system_allocator());
+  ck_assert(profile_start(&a));
+  ck_assert(profile_start(&b));
+
+  clock_t start = clock();
+  while ((atomic_load(&a.ticks) == 0 || atomic_load(&b.ticks) == 0) &&
+         clock() - start < 2 * CLOCKS_PER_SEC) {
+  }
+  profile_stop(&a);
+  profile_stop(&b);
+  ck_assert_ptr_null(a.timer);
+  ck_assert_uint_gt(a.outside, 0);
+  ck_assert_uint_gt(b.outside, 0);
+
+  profile_free(&a);
+  profile_free(&b);
+}
+END_TEST
+
+Suite* profile_suite(void) {
+  Suite* s = suite_create("profile");
+
+  TCase* tc = tcase_create("profile");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_instruction_counts);
+  tcase_add_test(tc, test_sequence_counts);
+  tcase_add_test(tc, test_deoptimized_counts);
+  tcase_add_test(tc, test_folded_output);
+  tcase_add_test(tc, test_allocator);
+  tcase_add_test(tc, test_separate_timers);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "scanner.h"
+#include "tests.h"
+
+#include "dmalloc.h"
+
+// Runs long enough to need several 16-byte blocks
+#define MAX_RUN 40
+
+// Copies `source` to `offset` bytes into a fresh buffer, so runs start and
+// end at every position within a block
+static char* place(const char* source, size_t offset) {
+  size_t length = strlen(source);
+  char* buffer = malloc(offset + length + 1);
+  memset(buffer, 'x', offset);
+  memcpy(buffer + offset, source, length + 1);
+  return buffer;
+}
+
+static void expect_token(Scanner* scanner, TokenType type, long length,
+                         long line) {
+  Token token = scan_token(scanner);
+  ck_assert_int_eq(token.type, type);
+  ck_assert_int_eq(token.length, length);
+  ck_assert_int_eq(token.line, line);
+}
+
+START_TEST(test_run_lengths) {
+  char source[8 * MAX_RUN];
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (int run = 0; run < MAX_RUN; run++) {
+      // Blanks with a newline every third byte, an identifier, a comment,
+      // and a string that spans lines
+      int length = 0;
+      int lines = 1;
+      for (int i = 0; i < run; i++) {
+        source[length++] = (i % 3 == 2) ? '\n' : " \t\r"[i % 3];
+        lines += (i % 3 == 2);
+      }
+      for (int i = 0; i <= run; i++) {
+        source[length++] = "aZ_9"[i % 4];
+      }
+      source[length++] = ' ';
+      for (int i = 0; i < 2 + run; i++) {
+        source[length++] = '/';
+      }
+      source[length++] = '\n';
+      source[length++] = '"';
+      for (int i = 0; i < run; i++) {
+        source[length++] = (i % 5 == 4) ? '\n' : 's';
+      }
+      source[length++] = '"';
+      source[length] = '\0';
+
+      char* buffer = place(source, offset);
+      Scanner scanner;
+      scanner_init(&scanner, buffer + offset);
+      expect_token(&scanner, TOKEN_IDENTIFIER, run + 1, lines);
+      expect_token(&scanner, TOKEN_STRING, run + 2, lines + 1 + run / 5);
+      expect_token(&scanner, TOKEN_EOF, 0, lines + 1 + run / 5);
+      free(buffer);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_identifier_bounds) {
+  // The bytes on either side of each identifier character range, and
+  // bytes with the top bit set
+  const char* stops = "@[`{/:\x80\xc1\xff";
+  char source[64];
+  for (const char* stop = stops; *stop != '\0'; stop++) {
+    for (int length = 1; length < 32; length++) {
+      for (int i = 0; i < length; i++) {
+        source[i] = "AZaz09_"[i % 7];
+      }
+      source[length] = *stop;
+      source[length + 1] = '\0';
+
+      Scanner scanner;
+      scanner_init(&scanner, source);
+      Token token = scan_token(&scanner);
+      ck_assert_int_eq(token.type, TOKEN_IDENTIFIER);
+      ck_assert_int_eq(token.length, length);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_unterminated) {
+  Scanner scanner;
+  scanner_init(&scanner, "// a comment running into the end of the source");
+  expect_token(&scanner, TOKEN_EOF, 0, 1);
+
+  scanner_init(&scanner, "\"a string\nrunning into the\nend of the source");
+  Token token = scan_token(&scanner);
+  ck_assert_int_eq(token.type, TOKEN_ERROR);
+  ck_assert_str_eq(token.start, "unterminated string");
+  ck_assert_int_eq(token.line, 3);
+  expect_token(&scanner, TOKEN_EOF, 0, 3);
+}
+END_TEST
+
+START_TEST(test_keywords) {
+  struct {
+    const char* name;
+    TokenType type;
+  } keywords[] = {
+      {"and", TOKEN_AND},       {"class", TOKEN_CLASS}, {"else", TOKEN_ELSE},
+      {"false", TOKEN_FALSE},   {"for", TOKEN_FOR},     {"fun", TOKEN_FUN},
+      {"if", TOKEN_IF},         {"nil", TOKEN_NIL},     {"or", TOKEN_OR},
+      {"print", TOKEN_PRINT},   {"return", TOKEN_RETURN},
+      {"super", TOKEN_SUPER},   {"this", TOKEN_THIS},   {"true", TOKEN_TRUE},
+      {"var", TOKEN_VAR},       {"while", TOKEN_WHILE},
+  };
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    Scanner scanner;
+    scanner_init(&scanner, keywords[i].name);
+    expect_token(&scanner, keywords[i].type, (long)strlen(keywords[i].name),
+                 1);
+  }
+
+  // Prefixes, extensions, and words hashing to a keyword's slot
+  Scanner scanner;
+  scanner_init(&scanner,
+               "an andy clas classy fals fo fore f i iff ni o orr prin "
+               "returns supe thi tru va whil _and And vaR whale tree");
+  for (int i = 0; i < 25; i++) {
+    ck_assert_int_eq(scan_token(&scanner).type, TOKEN_IDENTIFIER);
+  }
+  expect_token(&scanner, TOKEN_EOF, 0, 1);
+}
+END_TEST
+
+START_TEST(test_punctuation) {
+  Scanner scanner;
+  scanner_init(&scanner, "(){},.-+;/*! != = == > >= < <= @");
+  for (TokenType type = TOKEN_LEFT_PAREN; type <= TOKEN_LESS_EQUAL; type++) {
+    ck_assert_int_eq(scan_token(&scanner).type, type);
+  }
+  Token token = scan_token(&scanner);
+  ck_assert_int_eq(token.type, TOKEN_ERROR);
+  ck_assert_str_eq(token.start, "unexpected character");
+  expect_token(&scanner, TOKEN_EOF, 0, 1);
+  expect_token(&scanner, TOKEN_EOF, 0, 1);
+}
+END_TEST
+
+Suite* scanner_suite(void) {
+  Suite* s = suite_create("scanner");
+
+  TCase* tc = tcase_create("runs");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_run_lengths);
+  tcase_add_test(tc, test_identifier_bounds);
+  tcase_add_test(tc, test_unterminated);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("tokens");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_keywords);
+  tcase_add_test(tc, test_punctuation);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
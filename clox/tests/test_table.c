@@ -0,0 +1,124 @@
+#include <stdio.h>
+
+#include "check.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+#define KEY_COUNT 2000
+
+static VM vm;
+static ObjString* keys[KEY_COUNT];
+
+static void setup_keys(void) {
+  setup_dmalloc();
+  vm_init(&vm, system_allocator());
+  char buffer[16];
+  for (int i = 0; i < KEY_COUNT; i++) {
+    int length = sprintf(buffer, "key%d", i);
+    keys[i] = string_copy(&vm, buffer, (size_t)length);
+  }
+}
+
+static void teardown_keys(void) {
+  vm_free(&vm);
+  teardown_dmalloc();
+}
+
+START_TEST(test_set_get_delete) {
+  Table table;
+  table_init(&table, system_allocator());
+
+  Value value;
+  ck_assert(!table_get(&table, keys[0], &value));
+  ck_assert(!table_delete(&table, keys[0]));
+
+  for (int i = 0; i < KEY_COUNT; i++) {
+    ck_assert(table_set(&table, keys[i], NUMBER_VALUE(i)));
+  }
+  ck_assert_uint_eq(table.count, KEY_COUNT);
+
+  // Overwriting doesn't add entries
+  ck_assert(table_set(&table, keys[7], NUMBER_VALUE(-7)));
+  ck_assert_uint_eq(table.count, KEY_COUNT);
+
+  for (int i = 0; i < KEY_COUNT; i += 2) {
+    ck_assert(table_delete(&table, keys[i]));
+  }
+  ck_assert(!table_delete(&table, keys[0]));
+
+  for (int i = 0; i < KEY_COUNT; i++) {
+    bool found = table_get(&table, keys[i], &value);
+    ck_assert_int_eq(found, i % 2 == 1);
+    if (found) {
+      ck_assert_double_eq(AS_NUMBER(value), i == 7 ? -7 : i);
+    }
+  }
+
+  table_free(&table);
+}
+END_TEST
+
+START_TEST(test_churn) {
+  // Repeatedly inserting and deleting a bounded working set must not keep
+  // growing the table, however many tombstones it leaves behind
+  Table table;
+  table_init(&table, system_allocator());
+
+  size_t live = 100;
+  for (size_t i = 0; i < live; i++) {
+    ck_assert(table_set(&table, keys[i], NIL_VALUE()));
+  }
+
+  size_t capacity = 0;
+  for (size_t i = live; i < KEY_COUNT; i++) {
+    ck_assert(table_delete(&table, keys[i - live]));
+    ck_assert(table_set(&table, keys[i], NIL_VALUE()));
+    ck_assert_uint_eq(table.count, live);
+    ck_assert(table.count + table.tombstones < table.capacity);
+
+    // The table may grow once to make room for tombstones, but no more
+    if (i == 4 * live) {
+      capacity = table.capacity;
+    }
+  }
+  ck_assert_uint_eq(table.capacity, capacity);
+
+  Value value;
+  for (size_t i = 0; i < KEY_COUNT; i++) {
+    ck_assert_int_eq(table_get(&table, keys[i], &value),
+                     i >= KEY_COUNT - live);
+  }
+
+  table_free(&table);
+}
+END_TEST
+
+START_TEST(test_find_string) {
+  Table* strings = &vm.strings;
+  ObjString* key = keys[123];
+  ck_assert_ptr_eq(
+      table_find_string(strings, "key123", 6, "", 0, key->hash), key);
+  ck_assert_ptr_eq(
+      table_find_string(strings, "key", 3, "123", 3, key->hash), key);
+  ck_assert_ptr_null(
+      table_find_string(strings, "key12", 5, "", 0, key->hash));
+}
+END_TEST
+
+Suite* table_suite(void) {
+  Suite* s = suite_create("table");
+
+  TCase* tc = tcase_create("operations");
+  tcase_add_checked_fixture(tc, setup_keys, teardown_keys);
+  tcase_add_test(tc, test_set_get_delete);
+  tcase_add_test(tc, test_churn);
+  tcase_add_test(tc, test_find_string);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
@@ -0,0 +1,477 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "compiler.h"
+#include "debug.h"
+#include "object.h"
+#include "tests.h"
+#include "vm.h"
+
+#include "dmalloc.h"
+
+#define WORKER_COUNT 32
+#define WORKER_ITERATIONS 500
+
+typedef struct {
+  pthread_t thread;
+  int id;
+  int failures;
+} Worker;
+
+// Each worker owns a VM and cycles through scripts that succeed, fail to
+// compile and fail at runtime. A VM must always be left with an empty stack,
+// whatever its neighbours are doing.
+static void* run_worker(void* arg) {
+  Worker* worker = arg;
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  char source[128];
+  for (int i = 0; i < WORKER_ITERATIONS; i++) {
+    InterpretResult expected;
+    switch (i % 3) {
+      case 0:
+        snprintf(source, sizeof(source), "(%d + %d) * -%d.5 / 7;", worker->id,
+                 i, i);
+        expected = INTERPRET_OK;
+        break;
+      case 1:
+        snprintf(source, sizeof(source), "%d + ;", i);
+        expected = INTERPRET_COMPILE_ERROR;
+        break;
+      default:
+        snprintf(source, sizeof(source), "%d * -nil;", i);
+        expected = INTERPRET_RUNTIME_ERROR;
+        break;
+    }
+
+    if (interpret(&vm, source) != expected || vm.stack_top != vm.stack) {
+      worker->failures++;
+    }
+  }
+
+  vm_free(&vm);
+  return NULL;
+}
+
+START_TEST(test_concurrent_vms) {
+  Worker workers[WORKER_COUNT];
+  for (int i = 0; i < WORKER_COUNT; i++) {
+    workers[i].id = i;
+    workers[i].failures = 0;
+    ck_assert_int_eq(
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]), 0);
+  }
+
+  for (int i = 0; i < WORKER_COUNT; i++) {
+    ck_assert_int_eq(pthread_join(workers[i].thread, NULL), 0);
+    ck_assert_msg(workers[i].failures == 0, "worker %d had %d failures", i,
+                  workers[i].failures);
+  }
+}
+END_TEST
+
+START_TEST(test_independent_vms) {
+  // A runtime error in one VM leaves another VM untouched
+  VM a, b;
+  vm_init(&a, system_allocator());
+  vm_init(&b, system_allocator());
+
+  push(&b, NUMBER_VALUE(42));
+  ck_assert_int_eq(interpret(&a, "-nil;"), INTERPRET_RUNTIME_ERROR);
+  ck_assert_ptr_eq(a.stack_top, a.stack);
+  ck_assert_double_eq(AS_NUMBER(pop(&b)), 42);
+
+  vm_free(&a);
+  vm_free(&b);
+}
+END_TEST
+
+START_TEST(test_max_stack) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, "1 + (2 * (3 - -nil));", &chunk));
+  ck_assert_uint_eq(chunk.max_stack, 4);
+  chunk_free(&chunk);
+
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, "(nil + nil) * (true - false);", &chunk));
+  ck_assert_uint_eq(chunk.max_stack, 3);
+  chunk_free(&chunk);
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_stack_limit) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  vm.stack_limit = 3;
+
+  ck_assert_int_eq(interpret(&vm, "1 + (2 * (3 - -nil));"),
+                   INTERPRET_RUNTIME_ERROR);
+  ck_assert_uint_eq(vm.stack_capacity, 0);
+  ck_assert_int_eq(interpret(&vm, "1 + (2 * -nil);"),
+                   INTERPRET_RUNTIME_ERROR);
+  ck_assert_uint_eq(vm.stack_capacity, 3);
+  ck_assert_ptr_eq(vm.stack_top, vm.stack);
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_stack_growth) {
+  // Deeply nested operands need far more than the initial stack
+  size_t depth = 10 * STACK_MIN;
+  char* source = malloc(depth * 6 + 8);
+  char* p = source;
+  for (size_t i = 0; i < depth; i++) {
+    p += sprintf(p, "1 + (");
+  }
+  p += sprintf(p, "-nil");
+  for (size_t i = 0; i < depth; i++) {
+    *p++ = ')';
+  }
+  *p++ = ';';
+  *p = '\0';
+
+  VM vm;
+  vm_init(&vm, system_allocator());
+  ck_assert_int_eq(interpret(&vm, source), INTERPRET_RUNTIME_ERROR);
+  ck_assert(vm.stack_capacity >= depth + 1);
+  vm_free(&vm);
+  free(source);
+}
+END_TEST
+
+static Value global(VM* vm, const char* name) {
+  ObjString* string = string_copy(vm, name, strlen(name));
+  return vm->globals.values[vm_global_slot(vm, string)];
+}
+
+START_TEST(test_globals) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ck_assert_int_eq(interpret(&vm, "var a = 1; var b = a + 2; a = b = a + b;"),
+                   INTERPRET_OK);
+  ck_assert_double_eq(AS_NUMBER(global(&vm, "a")), 4);
+  ck_assert_double_eq(AS_NUMBER(global(&vm, "b")), 4);
+  ck_assert_uint_eq(vm.globals.count, 2);
+
+  // Redefining a global reuses its slot
+  ck_assert_int_eq(interpret(&vm, "var a = \"a\";"), INTERPRET_OK);
+  ck_assert(IS_STRING(global(&vm, "a")));
+  ck_assert_uint_eq(vm.globals.count, 2);
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_undefined_globals) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ck_assert_int_eq(interpret(&vm, "print late;"), INTERPRET_RUNTIME_ERROR);
+  ck_assert_int_eq(interpret(&vm, "late = 1;"), INTERPRET_RUNTIME_ERROR);
+  ck_assert(IS_UNDEFINED(global(&vm, "late")));
+  ck_assert_ptr_eq(vm.stack_top, vm.stack);
+
+  // A later chunk can define a global an earlier one referred to
+  ck_assert_int_eq(interpret(&vm, "var late = 2;"), INTERPRET_OK);
+  ck_assert_int_eq(interpret(&vm, "late = late * 3;"), INTERPRET_OK);
+  ck_assert_double_eq(AS_NUMBER(global(&vm, "late")), 6);
+  ck_assert_uint_eq(vm.globals.count, 1);
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_statement_errors) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ck_assert_int_eq(interpret(&vm, "1 + 2"), INTERPRET_COMPILE_ERROR);
+  ck_assert_int_eq(interpret(&vm, "var 1 = 2;"), INTERPRET_COMPILE_ERROR);
+  ck_assert_int_eq(interpret(&vm, "var a; 1 + a = 2;"),
+                   INTERPRET_COMPILE_ERROR);
+  ck_assert_int_eq(interpret(&vm, "var a; print a;"), INTERPRET_OK);
+  ck_assert(IS_NIL(global(&vm, "a")));
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_folded_constants) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  // Operands folded away leave the pool, and the pool stays deduplicated
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, "print 1 + 2; print 3; print 1; print 2 + 1;",
+                    &chunk));
+  ck_assert_uint_eq(chunk.constants.count, 2);
+  ck_assert(AS_NUMBER(chunk.constants.values[0]) == 3);
+  ck_assert(AS_NUMBER(chunk.constants.values[1]) == 1);
+  chunk_free(&chunk);
+
+  // Many folds reusing the same operands, as generated code does
+  char source[64 * 32] = "";
+  for (int i = 0; i < 64; i++) {
+    char line[32];
+    snprintf(line, sizeof(line), "print (%d + 2.5) * 3;", i % 8);
+    strcat(source, line);
+  }
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, source, &chunk));
+  ck_assert_uint_eq(chunk.constants.count, 8);
+  chunk_free(&chunk);
+
+  vm_free(&vm);
+}
+END_TEST
+
+// Checks a global's value, and that it is only stored as an integer if it
+// is one in range (other than -0)
+static void expect_number(VM* vm, const char* name, double expected) {
+  Value value = global(vm, name);
+  ck_assert(IS_NUMBER(value));
+  double number = AS_NUMBER(value);
+  ck_assert_msg(memcmp(&number, &expected, sizeof(double)) == 0,
+                "%s: got %.17g, expected %.17g", name, number, expected);
+  bool integral = expected >= (double)INTEGER_MIN &&
+                  expected <= (double)INTEGER_MAX &&
+                  expected == (double)(int64_t)expected &&
+                  !(expected == 0 && signbit(expected));
+  ck_assert_msg(integral || !IS_INTEGER(value), "%s: integer", name);
+}
+
+START_TEST(test_integer_arithmetic) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  ck_assert_int_eq(interpret(&vm,
+                             "var a = 2; var b = a * 3 - 10; var c = -b;"
+                             "var d = a + 0.5; var e = a / 2; var f = 3.0;"
+                             "var z = 0; var m = z * -1; var n = -z;"),
+                   INTERPRET_OK);
+  expect_number(&vm, "a", 2);
+  expect_number(&vm, "b", -4);
+  expect_number(&vm, "c", 4);
+  expect_number(&vm, "d", 2.5);
+  // Division always gives a double
+  ck_assert(IS_DOUBLE(global(&vm, "e")));
+  ck_assert(AS_NUMBER(global(&vm, "e")) == 1);
+  expect_number(&vm, "f", 3);
+  ck_assert(IS_INTEGER(global(&vm, "a")) && IS_INTEGER(global(&vm, "b")) &&
+            IS_INTEGER(global(&vm, "c")) && IS_INTEGER(global(&vm, "f")));
+  // -0 can only be a double
+  expect_number(&vm, "m", -0.0);
+  expect_number(&vm, "n", -0.0);
+
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_integer_overflow) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+
+  // Results that don't fit are the doubles that double arithmetic gives
+  ck_assert_int_eq(interpret(&vm,
+                             "var big = 100000000; var square = big * big;"
+                             "var cube = square * big;"
+                             "var top = 9007199254740992; var past = top + 1;"
+                             "var below = -top - 3;"
+                             "var edge = 140737488355327;"
+                             "var over = edge + 1; var under = -edge - 2;"
+                             "var twice = edge * 2; var flip = -(-edge - 1);"),
+                   INTERPRET_OK);
+  expect_number(&vm, "square", 1e16);
+  expect_number(&vm, "cube", 1e24);
+  expect_number(&vm, "past", 9007199254740992.0);
+  expect_number(&vm, "below", -9007199254740996.0);
+  expect_number(&vm, "over", 140737488355328.0);
+  expect_number(&vm, "under", -140737488355329.0);
+  expect_number(&vm, "twice", 281474976710654.0);
+  expect_number(&vm, "flip", 140737488355328.0);
+
+  vm_free(&vm);
+}
+END_TEST
+
+// Returns the opcodes of `chunk`'s arithmetic instructions, in order
+static void arithmetic_opcodes(Chunk* chunk, uint8_t* opcodes, size_t count) {
+  size_t found = 0;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += chunk_instruction_size(chunk, offset)) {
+    uint8_t opcode = chunk->code[offset];
+    switch (opcode) {
+      case OP_CONSTANT:
+      case OP_CONSTANT_LONG:
+      case OP_GET_GLOBAL:
+      case OP_DEFINE_GLOBAL:
+      case OP_SET_GLOBAL:
+      case OP_SET_GLOBAL_POP:
+      case OP_POP:
+      case OP_RETURN:
+        break;
+      default:
+        ck_assert_uint_lt(found, count);
+        opcodes[found++] = opcode;
+        break;
+    }
+  }
+  ck_assert_uint_eq(found, count);
+}
+
+static void expect_opcodes(Chunk* chunk, OpCode add, OpCode subtract,
+                           OpCode multiply, OpCode divide) {
+  uint8_t opcodes[4];
+  arithmetic_opcodes(chunk, opcodes, 4);
+  ck_assert_str_eq(opcode_name(opcodes[0]), opcode_name(add));
+  ck_assert_str_eq(opcode_name(opcodes[1]), opcode_name(subtract));
+  ck_assert_str_eq(opcode_name(opcodes[2]), opcode_name(multiply));
+  ck_assert_str_eq(opcode_name(opcodes[3]), opcode_name(divide));
+}
+
+START_TEST(test_quickening) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  ck_assert_int_eq(interpret(&vm, "var x = 6; var y = 3; var z;"),
+                   INTERPRET_OK);
+
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, "z = x + y; z = x - y; z = x * y; z = x / y;",
+                    &chunk));
+  expect_opcodes(&chunk, OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE);
+
+  // Integers, and a quotient that is always a double
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  expect_opcodes(&chunk, OP_ADD_INT, OP_SUBTRACT_INT, OP_MULTIPLY_INT,
+                 OP_DIVIDE);
+  ck_assert(AS_NUMBER(global(&vm, "z")) == 2);
+
+  // Doubles fail the integer forms' guards, and the generic forms they go
+  // back to quicken again for doubles
+  ck_assert_int_eq(interpret(&vm, "x = 1.5; y = 0.5;"), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  expect_opcodes(&chunk, OP_ADD_NUM, OP_SUBTRACT_NUM, OP_MULTIPLY_NUM,
+                 OP_DIVIDE_NUM);
+  ck_assert(AS_NUMBER(global(&vm, "z")) == 3);
+
+  // Mixed operands leave instructions generic
+  ck_assert_int_eq(interpret(&vm, "x = 3;"), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  expect_opcodes(&chunk, OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE);
+  ck_assert(AS_NUMBER(global(&vm, "z")) == 6);
+
+  // Results that don't fit fall back to doubles, and strings still add
+  ck_assert_int_eq(interpret(&vm, "x = 9007199254740992; y = 2;"),
+                   INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  ck_assert_int_eq(interpret(&vm, "x = 9007199254740990;"), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  ck_assert(AS_NUMBER(global(&vm, "z")) == 4503599627370495);
+  ck_assert_int_eq(interpret(&vm, "x = \"a\"; y = \"b\";"), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_RUNTIME_ERROR);
+  ck_assert_str_eq(AS_CSTRING(global(&vm, "z")), "ab");
+
+  chunk_free(&chunk);
+  vm_free(&vm);
+}
+END_TEST
+
+START_TEST(test_superinstructions) {
+  VM vm;
+  vm_init(&vm, system_allocator());
+  ck_assert_int_eq(interpret(&vm, "var x = 6; var z;"), INTERPRET_OK);
+
+  // Number constants on the right are fused into the operator, and the
+  // assignments into the pops after them
+  Chunk chunk;
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm, "z = x + 2; z = z - 0.5; z = z * -4; z = z / 2;",
+                    &chunk));
+  expect_opcodes(&chunk, OP_CONSTANT_ADD, OP_CONSTANT_SUBTRACT,
+                 OP_CONSTANT_MULTIPLY, OP_CONSTANT_DIVIDE);
+  ck_assert_uint_eq(chunk.code[chunk.count - 4], OP_SET_GLOBAL_POP);
+
+  // Integers, doubles and a mix of the two
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  expect_number(&vm, "z", -15);
+  ck_assert_int_eq(interpret(&vm, "x = 1.5;"), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  expect_number(&vm, "z", -6);
+  ck_assert_int_eq(interpret(&vm, "x = 140737488355327;"), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_OK);
+  expect_number(&vm, "z", -281474976710657.0);
+  ck_assert_int_eq(interpret(&vm, "x = \"a\";"), INTERPRET_OK);
+  ck_assert_int_eq(interpret_chunk(&vm, &chunk), INTERPRET_RUNTIME_ERROR);
+  chunk_free(&chunk);
+
+  // Anything else keeps the separate instructions
+  chunk_init(&chunk, system_allocator());
+  ck_assert(compile(&vm,
+                    "z = x + \"b\"; x - z; (z = x) * z; print z = 1 / 2;",
+                    &chunk));
+  expect_opcodes(&chunk, OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_PRINT);
+  ck_assert_uint_eq(chunk.code[chunk.count - 5], OP_SET_GLOBAL);
+  chunk_free(&chunk);
+
+  vm_free(&vm);
+}
+END_TEST
+
+Suite* vm_suite(void) {
+  Suite* s = suite_create("vm");
+
+  TCase* tc = tcase_create("reentrancy");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_set_timeout(tc, 30);
+  tcase_add_test(tc, test_independent_vms);
+  tcase_add_test(tc, test_concurrent_vms);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("stack");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_max_stack);
+  tcase_add_test(tc, test_stack_limit);
+  tcase_add_test(tc, test_stack_growth);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("constants");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_folded_constants);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("globals");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_globals);
+  tcase_add_test(tc, test_undefined_globals);
+  tcase_add_test(tc, test_statement_errors);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("integers");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_integer_arithmetic);
+  tcase_add_test(tc, test_integer_overflow);
+  tcase_add_test(tc, test_quickening);
+  suite_add_tcase(s, tc);
+
+  tc = tcase_create("superinstructions");
+  tcase_add_checked_fixture(tc, setup_dmalloc, teardown_dmalloc);
+  tcase_add_test(tc, test_superinstructions);
+  suite_add_tcase(s, tc);
+
+  return s;
+}
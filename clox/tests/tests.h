@@ -0,0 +1,20 @@
+#ifndef clox_tests_h
+#define clox_tests_h
+
+#include "check.h"
+
+Suite* cache_suite(void);
+Suite* gc_suite(void);
+Suite* memory_suite(void);
+Suite* number_suite(void);
+Suite* object_suite(void);
+Suite* output_suite(void);
+Suite* profile_suite(void);
+Suite* scanner_suite(void);
+Suite* table_suite(void);
+Suite* vm_suite(void);
+
+void setup_dmalloc(void);
+void teardown_dmalloc(void);
+
+#endif